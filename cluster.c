@@ -0,0 +1,272 @@
+//===================================================
+// Project: Collective motion at heavy metal concerts
+//===================================================
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "entbody_internal.h"
+#include "cluster.h"
+
+void cluster_init(cluster_t *c, long N){
+    long i;
+    c->N = N;
+    c->parent    = (int*)malloc(sizeof(int)*N);
+    c->label     = (int*)malloc(sizeof(int)*N);
+    c->prevlabel = (int*)malloc(sizeof(int)*N);
+    c->order     = (int*)malloc(sizeof(int)*N);
+    c->start     = (int*)malloc(sizeof(int)*(N+1));
+    c->id        = (int*)malloc(sizeof(int)*N);
+    c->birth     = (double*)malloc(sizeof(double)*N);
+    c->previd    = (int*)malloc(sizeof(int)*N);
+    c->prevbirth = (double*)malloc(sizeof(double)*N);
+
+    for (i=0; i<N; i++)
+        c->prevlabel[i] = -1;
+    c->nclusters = 0;
+    c->nprev  = 0;
+    c->nextid = 0;
+}
+
+void cluster_free(cluster_t *c){
+    free(c->parent);
+    free(c->label);
+    free(c->prevlabel);
+    free(c->order);
+    free(c->start);
+    free(c->id);
+    free(c->birth);
+    free(c->previd);
+    free(c->prevbirth);
+}
+
+//===================================================
+// lock-free union-find: roots are only ever linked
+// to a smaller root with a compare and swap, and
+// finds halve their paths as they go
+//===================================================
+static int uf_find(int *parent, int i){
+    int p = __atomic_load_n(&parent[i], __ATOMIC_RELAXED);
+    while (p != i){
+        int gp = __atomic_load_n(&parent[p], __ATOMIC_RELAXED);
+        if (gp != p)
+            __atomic_compare_exchange_n(&parent[i], &p, gp, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        i = p;
+        p = __atomic_load_n(&parent[i], __ATOMIC_RELAXED);
+    }
+    return i;
+}
+
+static void uf_union(int *parent, int a, int b){
+    while (1){
+        a = uf_find(parent, a);
+        b = uf_find(parent, b);
+        if (a == b) return;
+        if (a < b){ int t = a; a = b; b = t; }
+        int expected = a;
+        if (__atomic_compare_exchange_n(&parent[a], &expected, b, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+            return;
+    }
+}
+
+//===================================================
+// join RED pairs within FR, label the clusters of
+// at least CLUSTER_MINSIZE particles and match them
+// to the clusters of the previous sample.  the boxes
+// are rebuilt first: those of the last step predate
+// its moves, and a particle that crossed a wall would
+// be searched from the far side.
+// this is a second 3x3 walk over the boxes rather than
+// unions made inside the force loop, which keeps the
+// step free of analysis and sees the positions after
+// the move.  a sample costs about a sixth of a step
+// (rebinning is a few percent of that), so about 1.6%
+// of the run at CLUSTER_STRIDE 10 for N = 1000-20000
+//===================================================
+int cluster_find(cluster_t *c, entbody_t *s){
+    long N = s->N;
+    double L = s->L;
+    int *parent = c->parent;
+    long i;
+    int k;
+
+    entbody_bin(s);
+
+    #ifdef OPENMP
+    #pragma omp parallel for schedule(static)
+    #endif
+    for (i=0; i<N; i++)
+        parent[i] = i;
+
+    #ifdef OPENMP
+    #pragma omp parallel for schedule(static)
+    #endif
+    for (i=0; i<N; i++){
+        int index[2], tt[2], tix[2], image[2];
+        int j, m;
+        if (s->type[i] != RED) continue;
+
+        index[0] = s->cellid[i] % s->size[0];
+        index[1] = s->cellid[i] / s->size[0];
+
+        for (tt[0]=-1; tt[0]<=1; tt[0]++){
+        for (tt[1]=-1; tt[1]<=1; tt[1]++){
+            int goodcell = 1;
+            for (j=0; j<2; j++){
+                tix[j] = mod_rvec(index[j]+tt[j], s->size[j]-1, s->pbc[j], &image[j]);
+                if (s->pbc[j] < image[j])
+                    goodcell = 0;
+            }
+            if (!goodcell) continue;
+
+            int ind = tix[0] + tix[1]*s->size[0];
+            int *list;
+            int nlist = cell_list(s, ind, &list);
+            for (m=0; m<nlist; m++){
+                int n = list[m];
+                if (n <= i || s->type[n] != RED) continue;
+
+                double dist = 0.0;
+                for (j=0; j<2; j++){
+                    double dx = s->x[2*n+j] - s->x[2*i+j];
+                    if (image[j])
+                        dx += L*tt[j];
+                    dist += dx*dx;
+                }
+                if (dist < s->FR2)
+                    uf_union(parent, i, n);
+            }
+        } }
+    }
+
+    #ifdef OPENMP
+    #pragma omp parallel for schedule(static)
+    #endif
+    for (i=0; i<N; i++)
+        parent[i] = uf_find(parent, i);
+
+    //-------------------------------------------
+    // sizes of the trees, then compact labels for
+    // the big enough ones (order is scratch here)
+    int *size = c->order;
+    for (i=0; i<N; i++)
+        size[i] = 0;
+    for (i=0; i<N; i++)
+        if (s->type[i] == RED) size[parent[i]]++;
+
+    int nclusters = 0;
+    for (i=0; i<N; i++)
+        c->label[i] = size[i] >= CLUSTER_MINSIZE ? nclusters++ : -1;
+    for (i=0; i<N; i++)
+        c->label[i] = s->type[i] == RED ? c->label[parent[i]] : -1;
+    c->nclusters = nclusters;
+
+    // group the members of each cluster together
+    for (k=0; k<=nclusters; k++)
+        c->start[k] = 0;
+    for (i=0; i<N; i++)
+        if (c->label[i] >= 0) c->start[c->label[i]+1]++;
+    for (k=0; k<nclusters; k++)
+        c->start[k+1] += c->start[k];
+    int *fill = (int*)malloc(sizeof(int)*(nclusters+1));
+    memcpy(fill, c->start, sizeof(int)*(nclusters+1));
+    for (i=0; i<N; i++)
+        if (c->label[i] >= 0) c->order[fill[c->label[i]]++] = i;
+    free(fill);
+
+    //-------------------------------------------
+    // each cluster inherits the id of the previous
+    // cluster it shares most members with, unless
+    // another piece of that cluster shares more
+    int nprev = c->nprev;
+    int *overlap = (int*)calloc(nprev+1, sizeof(int));
+    int *best    = (int*)malloc(sizeof(int)*(nclusters+1));
+    int *bestov  = (int*)malloc(sizeof(int)*(nclusters+1));
+    int *claim   = (int*)malloc(sizeof(int)*(nprev+1));
+    int *claimov = (int*)calloc(nprev+1, sizeof(int));
+
+    for (k=0; k<nclusters; k++){
+        int m;
+        best[k] = -1;
+        bestov[k] = 0;
+        for (m=c->start[k]; m<c->start[k+1]; m++){
+            int p = c->prevlabel[c->order[m]];
+            if (p < 0) continue;
+            if (++overlap[p] > bestov[k]){
+                bestov[k] = overlap[p];
+                best[k] = p;
+            }
+        }
+        for (m=c->start[k]; m<c->start[k+1]; m++){
+            int p = c->prevlabel[c->order[m]];
+            if (p >= 0) overlap[p] = 0;
+        }
+        if (best[k] >= 0 && bestov[k] > claimov[best[k]]){
+            claimov[best[k]] = bestov[k];
+            claim[best[k]] = k;
+        }
+    }
+
+    for (k=0; k<nclusters; k++){
+        if (best[k] >= 0 && claim[best[k]] == k){
+            c->id[k]    = c->previd[best[k]];
+            c->birth[k] = c->prevbirth[best[k]];
+        }
+        else {
+            c->id[k]    = c->nextid++;
+            c->birth[k] = s->t;
+        }
+    }
+
+    free(overlap);
+    free(best);
+    free(bestov);
+    free(claim);
+    free(claimov);
+
+    memcpy(c->prevlabel, c->label, sizeof(int)*N);
+    memcpy(c->previd, c->id, sizeof(int)*nclusters);
+    memcpy(c->prevbirth, c->birth, sizeof(double)*nclusters);
+    c->nprev = nclusters;
+    return nclusters;
+}
+
+//===================================================
+// one line per cluster: time, id, size, periodic
+// center of mass, angular momentum per particle about
+// that center, and age
+//===================================================
+void cluster_write(cluster_t *c, entbody_t *s, FILE *file){
+    double L = s->L;
+    int k, m;
+
+    for (k=0; k<c->nclusters; k++){
+        double xr = 0.0, xi = 0.0, yr = 0.0, yi = 0.0;
+        for (m=c->start[k]; m<c->start[k+1]; m++){
+            int i = c->order[m];
+            xr += cos(2*pi/L * s->x[2*i+0]);
+            xi += sin(2*pi/L * s->x[2*i+0]);
+            yr += cos(2*pi/L * s->x[2*i+1]);
+            yi += sin(2*pi/L * s->x[2*i+1]);
+        }
+        double cmx = atan2(xi, xr)/(2*pi) * L;
+        double cmy = atan2(yi, yr)/(2*pi) * L;
+        if (cmx < 0) cmx += L;
+        if (cmy < 0) cmy += L;
+
+        double ang = 0.0;
+        for (m=c->start[k]; m<c->start[k+1]; m++){
+            int i = c->order[m];
+            double tx = s->x[2*i+0] - cmx;
+            double ty = s->x[2*i+1] - cmy;
+            if (s->pbc[0] && tx > L/2)  tx -= L;
+            if (s->pbc[1] && ty > L/2)  ty -= L;
+            if (s->pbc[0] && tx < -L/2) tx += L;
+            if (s->pbc[1] && ty < -L/2) ty += L;
+            ang += s->v[2*i+0]*ty - s->v[2*i+1]*tx;
+        }
+
+        int size = c->start[k+1] - c->start[k];
+        fprintf(file, "%f %i %i %f %f %f %f\n", s->t, c->id[k], size,
+                cmx, cmy, ang/size, s->t - c->birth[k]);
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef __CLUSTER_H__
+#define __CLUSTER_H__
+
+#include <stdio.h>
+#include "entbody.h"
+
+//===================================================
+// moshpit identification.  RED particles closer than
+// the alignment range FR are joined with a lock-free
+// union-find over the neighbor boxes, and clusters
+// are followed from sample to sample by the overlap
+// of their members, so each one keeps an id and a
+// birth time
+//===================================================
+#define CLUSTER_MINSIZE 5
+
+typedef struct {
+    long   N;
+    int    *parent;     // union-find forest over particles
+    int    *label;      // cluster of each particle, -1 if none
+    int    *prevlabel;  // label at the previous sample
+    int    *order;      // particles grouped by cluster
+
+    int    nclusters;
+    int    *start;      // [nclusters+1] into order
+    int    *id;         // persistent id of each cluster
+    double *birth;      // time each persistent id appeared
+
+    int    nprev;
+    int    *previd;
+    double *prevbirth;
+    int    nextid;
+} cluster_t;
+
+void cluster_init(cluster_t *c, long N);
+void cluster_free(cluster_t *c);
+int  cluster_find(cluster_t *c, entbody_t *s);
+void cluster_write(cluster_t *c, entbody_t *s, FILE *file);
+
+#endif
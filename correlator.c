@@ -0,0 +1,194 @@
+//===================================================
+// Project: Collective motion at heavy metal concerts
+//===================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "correlator.h"
+
+void corr_init(correlator_t *c, int op, int nchan, int dim){
+    c->op    = op;
+    c->nchan = nchan;
+    c->dim   = dim;
+    c->block = (double*)calloc(nchan, sizeof(double));
+    memset(c->shift, 0, sizeof(c->shift));
+    memset(c->accum, 0, sizeof(c->accum));
+
+    memset(c->naccum, 0, sizeof(c->naccum));
+    memset(c->nshift, 0, sizeof(c->nshift));
+    memset(c->head,   0, sizeof(c->head));
+    memset(c->corr,   0, sizeof(c->corr));
+    memset(c->ncorr,  0, sizeof(c->ncorr));
+}
+
+void corr_free(correlator_t *c){
+    int level;
+    for (level=0; level<CORR_LEVELS; level++){
+        free(c->shift[level]);
+        free(c->accum[level]);
+    }
+    free(c->block);
+}
+
+//===================================================
+// push a sample into a level, correlate it against
+// the samples already there, and pass a compressed
+// block up once CORR_M samples have arrived
+//===================================================
+void corr_add(correlator_t *c, double *values){
+    int level, j, k;
+    int nchan = c->nchan;
+
+    for (level=0; level<CORR_LEVELS; level++){
+        // levels are only allocated once a sample reaches them,
+        // so the memory grows with log of the run length
+        if (!c->shift[level]){
+            c->shift[level] = (double*)calloc((size_t)CORR_P*nchan, sizeof(double));
+            c->accum[level] = (double*)calloc(nchan, sizeof(double));
+        }
+        double *shift = c->shift[level];
+        double *accum = c->accum[level];
+
+        c->head[level] = (c->head[level] + 1) % CORR_P;
+        double *now = &shift[c->head[level]*nchan];
+        memcpy(now, values, sizeof(double)*nchan);
+        c->nshift[level]++;
+
+        // the first CORR_P/CORR_M lags of the upper levels
+        // are already covered by the level below
+        int jmin = level == 0 ? 0 : CORR_P/CORR_M;
+        int jmax = c->nshift[level] < CORR_P ? c->nshift[level] : CORR_P;
+        for (j=jmin; j<jmax; j++){
+            double *then = &shift[((c->head[level] - j + CORR_P) % CORR_P)*nchan];
+            double sum = 0.0;
+            if (c->op == CORR_PRODUCT){
+                for (k=0; k<nchan; k++)
+                    sum += now[k]*then[k];
+            }
+            else {
+                for (k=0; k<nchan; k++)
+                    sum += (now[k]-then[k])*(now[k]-then[k]);
+            }
+            c->corr[level][j] += sum;
+            c->ncorr[level][j]++;
+        }
+
+        if (c->op == CORR_PRODUCT){
+            for (k=0; k<nchan; k++)
+                accum[k] += values[k];
+        }
+        else
+            memcpy(accum, values, sizeof(double)*nchan);
+
+        if (++c->naccum[level] < CORR_M)
+            return;
+
+        // the compressed block is the next level's sample
+        for (k=0; k<nchan; k++)
+            c->block[k] = c->op == CORR_PRODUCT ? accum[k] / CORR_M : accum[k];
+        memset(accum, 0, sizeof(double)*nchan);
+        c->naccum[level] = 0;
+        values = c->block;
+    }
+}
+
+// lags in steps, in the order of corr_result
+int corr_lags(long *lags, int max){
+    int level, j, n = 0;
+    long scale = 1;
+    for (level=0; level<CORR_LEVELS; level++){
+        for (j=(level==0 ? 0 : CORR_P/CORR_M); j<CORR_P && n<max; j++)
+            lags[n++] = j*scale;
+        scale *= CORR_M;
+    }
+    return n;
+}
+
+// correlation per item at each lag; returns how many lags have data
+int corr_result(correlator_t *c, double *out, int max){
+    int level, j, n = 0;
+    int items = c->nchan / c->dim;
+    for (level=0; level<CORR_LEVELS; level++){
+        for (j=(level==0 ? 0 : CORR_P/CORR_M); j<CORR_P && n<max; j++){
+            if (c->ncorr[level][j] == 0)
+                return n;
+            out[n++] = c->corr[level][j] / c->ncorr[level][j] / items;
+        }
+    }
+    return n;
+}
+
+//===================================================
+// one line per lag: the lag time and then each
+// correlator, as long as all of them have data
+//===================================================
+void corr_write(const char *name, correlator_t **c, int n, double dt){
+    long lags[CORR_LEVELS*CORR_P];
+    double out[CORR_LEVELS*CORR_P];
+    int i, j, nlags = corr_lags(lags, CORR_LEVELS*CORR_P);
+    int stride = nlags;
+
+    FILE *file = fopen(name, "w");
+    double *res = (double*)malloc(sizeof(double)*n*stride);
+    for (i=0; i<n; i++){
+        int m = corr_result(c[i], out, stride);
+        if (m < nlags) nlags = m;
+        for (j=0; j<m; j++)
+            res[i*stride + j] = out[j];
+    }
+
+    for (j=0; j<nlags; j++){
+        fprintf(file, "%f", lags[j]*dt);
+        for (i=0; i<n; i++)
+            fprintf(file, " %e", res[i*stride + j]);
+        fprintf(file, "\n");
+    }
+    fclose(file);
+    free(res);
+}
+
+//===================================================
+// the diffusion constant from the longest lag of the
+// MSD, MSD = 4 D t, and the relaxation time of the
+// angular momentum as the integral of its normalized
+// autocorrelation up to the first zero crossing
+//===================================================
+void corr_summary(correlator_t *ang, correlator_t *msd, double angavg, double dt,
+                  double *D, double *tau){
+    long lags[CORR_LEVELS*CORR_P];
+    double out[CORR_LEVELS*CORR_P];
+    int j, n;
+
+    corr_lags(lags, CORR_LEVELS*CORR_P);
+
+    n = corr_result(msd, out, CORR_LEVELS*CORR_P);
+    *D = n > 1 ? out[n-1] / (4*lags[n-1]*dt) : 0.0;
+
+    n = corr_result(ang, out, CORR_LEVELS*CORR_P);
+    *tau = 0.0;
+    if (n < 2) return;
+
+    double c0 = out[0] - angavg*angavg;
+    if (c0 <= 0) return;
+    for (j=1; j<n; j++){
+        double a = (out[j-1] - angavg*angavg) / c0;
+        double b = (out[j]   - angavg*angavg) / c0;
+        if (b <= 0) break;
+        *tau += 0.5*(a + b) * (lags[j] - lags[j-1])*dt;
+    }
+}
+
+// follow the periodic images so that xu is the unwrapped position
+void corr_unwrap(double *xu, double *xprev, double *x, long N, double L, int *pbc){
+    long i;
+    int k;
+    for (i=0; i<N; i++){
+        for (k=0; k<2; k++){
+            double dx = x[2*i+k] - xprev[2*i+k];
+            if (pbc[k] && dx >  L/2) dx -= L;
+            if (pbc[k] && dx < -L/2) dx += L;
+            xu[2*i+k] += dx;
+            xprev[2*i+k] = x[2*i+k];
+        }
+    }
+}
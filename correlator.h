@@ -0,0 +1,47 @@
+#ifndef __CORRELATOR_H__
+#define __CORRELATOR_H__
+
+//===================================================
+// online multi-tau correlators.  level 0 keeps the
+// last CORR_P samples, and every level above holds
+// blocks of CORR_M samples of the one below, so lags
+// up to CORR_P*CORR_M^(CORR_LEVELS-1) steps are kept
+// in O(nchan * CORR_P * log(steps)) memory
+//===================================================
+#define CORR_P      16
+#define CORR_M      2
+#define CORR_LEVELS 24
+
+#define CORR_PRODUCT 0  // <a(t) . a(t+tau)>, blocks are averaged
+#define CORR_SQDIST  1  // <|a(t+tau) - a(t)|^2>, blocks keep their last sample
+
+typedef struct {
+    int    op;
+    int    nchan;       // values per sample
+    int    dim;         // values per item (2 for vectors)
+
+    double *shift[CORR_LEVELS];     // [CORR_P][nchan] per level
+    double *accum[CORR_LEVELS];     // [nchan] per level
+    double *block;      // [nchan] sample passed to the next level
+    int    naccum[CORR_LEVELS];
+    long   nshift[CORR_LEVELS];
+    int    head[CORR_LEVELS];
+
+    double corr[CORR_LEVELS][CORR_P];
+    long   ncorr[CORR_LEVELS][CORR_P];
+} correlator_t;
+
+void corr_init(correlator_t *c, int op, int nchan, int dim);
+void corr_free(correlator_t *c);
+void corr_add(correlator_t *c, double *values);
+
+int  corr_lags(long *lags, int max);
+int  corr_result(correlator_t *c, double *out, int max);
+
+void corr_write(const char *name, correlator_t **c, int n, double dt);
+void corr_summary(correlator_t *ang, correlator_t *msd, double angavg, double dt,
+                  double *D, double *tau);
+
+void corr_unwrap(double *xu, double *xprev, double *x, long N, double L, int *pbc);
+
+#endif
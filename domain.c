@@ -0,0 +1,553 @@
+//===================================================
+// Project: Collective motion at heavy metal concerts
+//===================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "entbody_internal.h"
+#include "domain.h"
+
+#define EPSILON DBL_EPSILON
+
+//==================================================
+// slab bookkeeping
+//==================================================
+static int domain_owner(domain_t *d, int row){
+    return (int)(((long)(row+1)*d->nranks + d->rows - 1) / d->rows) - 1;
+}
+
+static int domain_row(domain_t *d, double *x){
+    int index[2];
+    coords_to_index(x, d->s->size, index, d->s->L);
+    return index[1];
+}
+
+// local row of a global row, lrows or more if not held
+static int domain_lrow(domain_t *d, int row){
+    return ((row - d->row0 + 1) % d->rows + d->rows) % d->rows;
+}
+
+static void domain_reserve(domain_t *d, long need){
+    if (need <= d->cap) return;
+    d->cap  = need + need/2;
+    d->gid  = (long*)realloc(d->gid, sizeof(long)*d->cap);
+    d->x    = (double*)realloc(d->x, sizeof(double)*2*d->cap);
+    d->v    = (double*)realloc(d->v, sizeof(double)*2*d->cap);
+    d->xn   = (double*)realloc(d->xn, sizeof(double)*2*d->cap);
+    d->vn   = (double*)realloc(d->vn, sizeof(double)*2*d->cap);
+    d->col  = (double*)realloc(d->col, sizeof(double)*d->cap);
+    d->type = (int*)realloc(d->type, sizeof(int)*d->cap);
+}
+
+static void domain_pack(domain_t *d, long i, double *buf){
+    buf[0] = d->gid[i];
+    buf[1] = d->x[2*i+0];
+    buf[2] = d->x[2*i+1];
+    buf[3] = d->v[2*i+0];
+    buf[4] = d->v[2*i+1];
+    buf[5] = d->type[i];
+    buf[6] = d->col[i];
+}
+
+static void domain_unpack(domain_t *d, long i, double *buf){
+    d->gid[i]      = (long)buf[0];
+    d->x[2*i+0]    = buf[1];
+    d->x[2*i+1]    = buf[2];
+    d->v[2*i+0]    = buf[3];
+    d->v[2*i+1]    = buf[4];
+    d->type[i]     = (int)buf[5];
+    d->col[i]      = buf[6];
+}
+
+//==================================================
+// send the packed particles in sendbuf (grouped by
+// rank, scount each) and return how many arrived
+// in recvbuf
+//==================================================
+static long domain_exchange(domain_t *d){
+    int r;
+    long nsend = 0, nrecv = 0;
+
+    MPI_Alltoall(d->scount, 1, MPI_INT, d->rcount, 1, MPI_INT, d->comm);
+    for (r=0; r<d->nranks; r++){
+        d->sdispl[r] = nsend * DOMAIN_PACK;
+        d->rdispl[r] = nrecv * DOMAIN_PACK;
+        nsend += d->scount[r];
+        nrecv += d->rcount[r];
+    }
+    if (nrecv > d->recvcap){
+        d->recvcap = nrecv + nrecv/2;
+        d->recvbuf = (double*)realloc(d->recvbuf, sizeof(double)*DOMAIN_PACK*d->recvcap);
+    }
+
+    for (r=0; r<d->nranks; r++){
+        d->scount[r] *= DOMAIN_PACK;
+        d->rcount[r] *= DOMAIN_PACK;
+    }
+    MPI_Alltoallv(d->sendbuf, d->scount, d->sdispl, MPI_DOUBLE,
+                  d->recvbuf, d->rcount, d->rdispl, MPI_DOUBLE, d->comm);
+    return nrecv;
+}
+
+static void domain_sendreserve(domain_t *d, long need){
+    if (need <= d->sendcap) return;
+    d->sendcap = need + need/2;
+    d->sendbuf = (double*)realloc(d->sendbuf, sizeof(double)*DOMAIN_PACK*d->sendcap);
+}
+
+//==================================================
+// creation and destruction.  every rank builds the
+// same serial instance (same seed, same state file)
+// and keeps the particles in its own rows
+//==================================================
+int domain_init(domain_t *d, entbody_t *s, MPI_Comm comm){
+    long i;
+    memset(d, 0, sizeof(domain_t));
+    d->s = s;
+    d->comm = comm;
+    MPI_Comm_rank(comm, &d->rank);
+    MPI_Comm_size(comm, &d->nranks);
+
+    d->rows = s->size[1];
+    if (d->nranks > d->rows)
+        return 0;
+    d->row0  = (int)((long)d->rank * d->rows / d->nranks);
+    d->row1  = (int)((long)(d->rank+1) * d->rows / d->nranks);
+    d->lrows = d->row1 - d->row0 + 2;
+    if (d->lrows > d->rows)
+        d->lrows = d->rows;
+
+    d->redrank = (long*)malloc(sizeof(long)*s->N);
+    d->nred = 0;
+    for (i=0; i<s->N; i++)
+        d->redrank[i] = s->type[i] == RED ? d->nred++ : -1;
+    d->noise = (double*)malloc(sizeof(double)*2*(d->nred+1));
+
+    for (i=0; i<s->N; i++){
+        int row = domain_row(d, &s->x[2*i]);
+        if (row < d->row0 || row >= d->row1) continue;
+
+        domain_reserve(d, d->n+1);
+        d->gid[d->n] = i;
+        d->x[2*d->n+0] = s->x[2*i+0];
+        d->x[2*d->n+1] = s->x[2*i+1];
+        d->v[2*d->n+0] = s->v[2*i+0];
+        d->v[2*d->n+1] = s->v[2*i+1];
+        d->type[d->n]  = s->type[i];
+        d->col[d->n]   = s->col[i];
+        d->n++;
+    }
+
+    int ncell = d->lrows * s->size[0];
+    d->count = (int*)malloc(sizeof(int)*ncell);
+    d->start = (int*)malloc(sizeof(int)*(ncell+1));
+    d->scount = (int*)malloc(sizeof(int)*d->nranks);
+    d->sdispl = (int*)malloc(sizeof(int)*d->nranks);
+    d->rcount = (int*)malloc(sizeof(int)*d->nranks);
+    d->rdispl = (int*)malloc(sizeof(int)*d->nranks);
+    return 1;
+}
+
+void domain_free(domain_t *d){
+    free(d->gid);
+    free(d->x);
+    free(d->v);
+    free(d->xn);
+    free(d->vn);
+    free(d->col);
+    free(d->type);
+    free(d->redrank);
+    free(d->noise);
+    free(d->count);
+    free(d->start);
+    free(d->cells);
+    free(d->sendbuf);
+    free(d->recvbuf);
+    free(d->scount);
+    free(d->sdispl);
+    free(d->rcount);
+    free(d->rdispl);
+}
+
+//==================================================
+// copy the owned particles of the rows next to other
+// slabs to the ranks that hold those rows as halos
+//==================================================
+static int domain_halo_dests(domain_t *d, long i, int *dest){
+    int row = domain_row(d, &d->x[2*i]);
+    int k, dr, ndest = 0;
+
+    for (dr=-1; dr<=1; dr+=2){
+        int nb = row + dr;
+        if (nb < 0 || nb >= d->rows){
+            if (!d->s->pbc[1]) continue;
+            nb = (nb + d->rows) % d->rows;
+        }
+        int r = domain_owner(d, nb);
+        if (r == d->rank) continue;
+        for (k=0; k<ndest; k++)
+            if (dest[k] == r) break;
+        if (k == ndest)
+            dest[ndest++] = r;
+    }
+    return ndest;
+}
+
+static void domain_halos(domain_t *d){
+    int r, k, dest[2];
+    long i, nsend = 0;
+
+    for (r=0; r<d->nranks; r++)
+        d->scount[r] = 0;
+    for (i=0; i<d->n; i++){
+        int ndest = domain_halo_dests(d, i, dest);
+        for (k=0; k<ndest; k++)
+            d->scount[dest[k]]++;
+        nsend += ndest;
+    }
+
+    domain_sendreserve(d, nsend);
+    long fill[d->nranks];
+    for (fill[0]=0, r=1; r<d->nranks; r++)
+        fill[r] = fill[r-1] + d->scount[r-1];
+    for (i=0; i<d->n; i++){
+        int ndest = domain_halo_dests(d, i, dest);
+        for (k=0; k<ndest; k++)
+            domain_pack(d, i, &d->sendbuf[DOMAIN_PACK*fill[dest[k]]++]);
+    }
+
+    long nrecv = domain_exchange(d);
+    domain_reserve(d, d->n + nrecv);
+    for (i=0; i<nrecv; i++)
+        domain_unpack(d, d->n+i, &d->recvbuf[DOMAIN_PACK*i]);
+    d->nhalo = nrecv;
+}
+
+//==================================================
+// local boxes over the held rows.  each box is kept
+// in order of the global index, as entbody_bin fills
+// them, so the force sums add up in the same order
+//==================================================
+static void domain_bin(domain_t *d){
+    int nx = d->s->size[0];
+    int ncell = d->lrows * nx;
+    long i, total = d->n + d->nhalo;
+    int c, j;
+
+    d->cells = (int*)realloc(d->cells, sizeof(int)*(total+1));
+    for (c=0; c<ncell; c++)
+        d->count[c] = 0;
+
+    int *cid = (int*)malloc(sizeof(int)*(total+1));
+    for (i=0; i<total; i++){
+        int index[2];
+        coords_to_index(&d->x[2*i], d->s->size, index, d->s->L);
+        cid[i] = index[0] + domain_lrow(d, index[1])*nx;
+        d->count[cid[i]]++;
+    }
+
+    d->start[0] = 0;
+    for (c=0; c<ncell; c++)
+        d->start[c+1] = d->start[c] + d->count[c];
+    for (c=0; c<ncell; c++)
+        d->count[c] = 0;
+    for (i=0; i<total; i++)
+        d->cells[d->start[cid[i]] + d->count[cid[i]]++] = i;
+    free(cid);
+
+    for (c=0; c<ncell; c++){
+        int *cell = &d->cells[d->start[c]];
+        for (j=1; j<d->count[c]; j++){
+            int t = cell[j], k = j;
+            while (k > 0 && d->gid[cell[k-1]] > d->gid[t]){
+                cell[k] = cell[k-1];
+                k--;
+            }
+            cell[k] = t;
+        }
+    }
+}
+
+//==================================================
+// send the particles that left the slab to their
+// new owner and drop the halos
+//==================================================
+static void domain_migrate(domain_t *d){
+    int r;
+    long i, keep = 0, nsend = 0;
+
+    for (r=0; r<d->nranks; r++)
+        d->scount[r] = 0;
+    for (i=0; i<d->n; i++){
+        r = domain_owner(d, domain_row(d, &d->x[2*i]));
+        if (r != d->rank){
+            d->scount[r]++;
+            nsend++;
+        }
+    }
+
+    domain_sendreserve(d, nsend);
+    long fill[d->nranks];
+    for (fill[0]=0, r=1; r<d->nranks; r++)
+        fill[r] = fill[r-1] + d->scount[r-1];
+    for (i=0; i<d->n; i++){
+        r = domain_owner(d, domain_row(d, &d->x[2*i]));
+        if (r != d->rank)
+            domain_pack(d, i, &d->sendbuf[DOMAIN_PACK*fill[r]++]);
+        else {
+            if (keep != i){
+                d->gid[keep] = d->gid[i];
+                d->x[2*keep+0] = d->x[2*i+0];
+                d->x[2*keep+1] = d->x[2*i+1];
+                d->v[2*keep+0] = d->v[2*i+0];
+                d->v[2*keep+1] = d->v[2*i+1];
+                d->type[keep]  = d->type[i];
+                d->col[keep]   = d->col[i];
+            }
+            keep++;
+        }
+    }
+
+    long nrecv = domain_exchange(d);
+    domain_reserve(d, keep + nrecv);
+    for (i=0; i<nrecv; i++)
+        domain_unpack(d, keep+i, &d->recvbuf[DOMAIN_PACK*i]);
+    d->n = keep + nrecv;
+    d->nhalo = 0;
+}
+
+//==================================================
+// one step of the owned particles, the same sums as
+// the fused step in entbody.c
+//==================================================
+void domain_step(domain_t *d){
+    entbody_t *s = d->s;
+    double L = s->L;
+    int *pbc = s->pbc;
+    int nx   = s->size[0];
+
+    double epsilon = s->epsilon;
+    double sigma   = s->sigma;
+    double alpha   = s->alpha;
+    double vhappy_black = s->vhappy_black;
+    double vhappy_red   = s->vhappy_red;
+    double damp_coeff   = s->damp_coeff;
+
+    double dt  = s->dt;
+    double R   = s->R;
+    double R2  = s->R2;
+    double FR2 = s->FR2;
+
+    long i;
+
+    domain_halos(d);
+    domain_bin(d);
+
+    // the whole stream is drawn on every rank so each
+    // RED particle gets the numbers it gets in serial
+    for (i=0; i<2*d->nred; i++)
+        d->noise[i] = ran_ran2(s);
+
+    int *type  = d->type;
+    double *x  = d->x;
+    double *v  = d->v;
+    double *xn = d->xn;
+    double *vn = d->vn;
+    double *col = d->col;
+
+    #ifdef OPENMP
+    #pragma omp parallel for schedule(static)
+    #endif
+    for (i=0; i<d->n; i++){
+        int j, k, n, goodcell, nn = 0;
+        int index[2], tt[2], tix[2], image[2];
+        double dx[2], fi[2] = {0.0, 0.0}, wi[2] = {0.0, 0.0};
+        double r0, l, co, co1, dist, wlen, vlen, vhappy;
+        double ci = col[i];
+
+        coords_to_index(&x[2*i], s->size, index, L);
+
+        for (tt[0]=-1; tt[0]<=1; tt[0]++){
+        for (tt[1]=-1; tt[1]<=1; tt[1]++){
+            goodcell = 1;
+            for (j=0; j<2; j++){
+                tix[j] = mod_rvec(index[j]+tt[j],s->size[j]-1,pbc[j],&image[j]);
+                if (pbc[j] < image[j])
+                    goodcell=0;
+            }
+
+            if (goodcell){
+                int ind = tix[0] + domain_lrow(d, tix[1])*nx;
+
+                for (j=0; j<d->count[ind]; j++){
+                    n = d->cells[d->start[ind]+j];
+
+                    dist = 0.0;
+                    for (k=0; k<2; k++){
+                        dx[k] = x[2*n+k] - x[2*i+k];
+
+                        if (image[k])
+                            dx[k] += L*tt[k];
+                        dist += dx[k]*dx[k];
+                    }
+
+                    if (dist > 1e-10 && dist < R2){
+                        r0 = R;
+                        l  = sqrt(dist);
+                        co1 = (1-l/r0);
+                        co = epsilon * co1*sqrt(co1) * (l<r0);
+                        for (k=0; k<2; k++){
+                            fi[k] += - dx[k]/l * co;
+                            ci += co*co*dx[k]*dx[k]/dist;
+                        }
+                    }
+                    if (dist > 1e-10 && dist < FR2 && type[n] == RED && type[i] == RED){
+                        for (k=0; k<2; k++)
+                            wi[k] += v[2*n+k];
+                        nn++;
+                    }
+                }
+            }
+        } }
+
+        wlen = sqrt(wi[0]*wi[0] + wi[1]*wi[1]);
+        if (type[i] == RED && nn > 0 && wlen > 1e-6){
+            fi[0] += alpha * wi[0] / wlen;
+            fi[1] += alpha * wi[1] / wlen;
+        }
+
+        vlen = sqrt(v[2*i+0]*v[2*i+0] + v[2*i+1]*v[2*i+1]);
+        vhappy = type[i]==RED?vhappy_red:vhappy_black;
+        if (vlen > 1e-6){
+            fi[0] += damp_coeff*(vhappy - vlen)*v[2*i+0]/vlen;
+            fi[1] += damp_coeff*(vhappy - vlen)*v[2*i+1]/vlen;
+        }
+
+        if (type[i] == RED){
+            long r = d->redrank[d->gid[i]];
+            double u1 = d->noise[2*r+0];
+            double u2 = 2*pi*d->noise[2*r+1];
+            double lfac = sqrt(-2*log(u1));
+            fi[0] += sigma*lfac*cos(u2);
+            fi[1] += sigma*lfac*sin(u2);
+        }
+
+        for (j=0; j<2; j++){
+            vn[2*i+j] = v[2*i+j] + fi[j] * dt;
+            xn[2*i+j] = x[2*i+j] + vn[2*i+j] * dt;
+
+            if (pbc[j] == 1){
+                if (xn[2*i+j] >= L-EPSILON || xn[2*i+j] < 0)
+                    xn[2*i+j] = mymod(xn[2*i+j], L);
+            }
+            else {
+                const double restoration = 1.0;
+                if (xn[2*i+j] >= L){xn[2*i+j] = 2*L-xn[2*i+j]; vn[2*i+j] *= -restoration;}
+                if (xn[2*i+j] < 0) {xn[2*i+j] = -xn[2*i+j];    vn[2*i+j] *= -restoration;}
+                if (xn[2*i+j] >= L-EPSILON || xn[2*i+j] < 0){xn[2*i+j] = mymod(xn[2*i+j], L);}
+            }
+        }
+        col[i] = ci/12;
+    }
+
+    d->x = xn;  d->xn = x;
+    d->v = vn;  d->vn = v;
+    domain_migrate(d);
+
+    s->t += dt;
+    s->step++;
+}
+
+//==================================================
+// the observables of entbody_observe, with the sums
+// over particles reduced across the ranks
+//==================================================
+void domain_observe(domain_t *d, entbody_obs_t *obs){
+    double L = d->s->L;
+    int *pbc = d->s->pbc;
+    double sum[7] = {0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0};
+    long i;
+
+    for (i=0; i<d->n; i++){
+        if (d->type[i] == RED){
+            sum[0] += cos(2*pi/L * d->x[2*i+0]);
+            sum[1] += sin(2*pi/L * d->x[2*i+0]);
+            sum[2] += cos(2*pi/L * d->x[2*i+1]);
+            sum[3] += sin(2*pi/L * d->x[2*i+1]);
+            sum[4] += d->v[2*i+0];
+            sum[5] += d->v[2*i+1];
+            sum[6] += 1;
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, sum, 7, MPI_DOUBLE, MPI_SUM, d->comm);
+
+    double cmx = atan2(sum[1], sum[0])/(2*pi) * L;
+    double cmy = atan2(sum[3], sum[2])/(2*pi) * L;
+    if (cmx < 0) cmx += L;
+    if (cmy < 0) cmy += L;
+
+    double ang = 0.0;
+    for (i=0; i<d->n; i++){
+        if (d->type[i] == RED){
+            double tx = d->x[2*i+0] - cmx;
+            double ty = d->x[2*i+1] - cmy;
+            if (pbc[0] && tx > L/2)  tx -= L;
+            if (pbc[1] && ty > L/2)  ty -= L;
+            if (pbc[0] && tx < -L/2) tx += L;
+            if (pbc[1] && ty < -L/2) ty += L;
+            ang += d->v[2*i+0]*ty - d->v[2*i+1]*tx;
+        }
+    }
+    MPI_Allreduce(MPI_IN_PLACE, &ang, 1, MPI_DOUBLE, MPI_SUM, d->comm);
+
+    obs->t          = d->s->t;
+    obs->angularmom = ang / sum[6];
+    obs->momentumx  = sum[4] / sum[6];
+    obs->momentumy  = sum[5] / sum[6];
+    obs->cmx        = cmx;
+    obs->cmy        = cmy;
+}
+
+//==================================================
+// collect every particle into the serial arrays of
+// rank 0 in global order, e.g. for entbody_save
+//==================================================
+void domain_gather(domain_t *d){
+    entbody_t *s = d->s;
+    int r, count = d->n * DOMAIN_PACK;
+    long i;
+
+    domain_sendreserve(d, d->n);
+    for (i=0; i<d->n; i++)
+        domain_pack(d, i, &d->sendbuf[DOMAIN_PACK*i]);
+
+    MPI_Gather(&count, 1, MPI_INT, d->rcount, 1, MPI_INT, 0, d->comm);
+    long total = 0;
+    if (d->rank == 0){
+        for (r=0; r<d->nranks; r++){
+            d->rdispl[r] = total;
+            total += d->rcount[r];
+        }
+        if (total/DOMAIN_PACK > d->recvcap){
+            d->recvcap = total/DOMAIN_PACK;
+            d->recvbuf = (double*)realloc(d->recvbuf, sizeof(double)*total);
+        }
+    }
+    MPI_Gatherv(d->sendbuf, count, MPI_DOUBLE, d->recvbuf, d->rcount, d->rdispl,
+                MPI_DOUBLE, 0, d->comm);
+
+    if (d->rank == 0){
+        for (i=0; i<total/DOMAIN_PACK; i++){
+            double *buf = &d->recvbuf[DOMAIN_PACK*i];
+            long g = (long)buf[0];
+            s->x[2*g+0] = buf[1];
+            s->x[2*g+1] = buf[2];
+            s->v[2*g+0] = buf[3];
+            s->v[2*g+1] = buf[4];
+            s->type[g]  = (int)buf[5];
+            s->col[g]   = buf[6];
+        }
+    }
+}
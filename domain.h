@@ -0,0 +1,59 @@
+#ifndef __DOMAIN_H__
+#define __DOMAIN_H__
+
+#include <mpi.h>
+#include "entbody.h"
+
+//===================================================
+// spatial domain decomposition over MPI ranks.  the
+// box is cut into slabs of whole rows of the serial
+// neighbor boxes and each rank owns the particles in
+// its rows.  every step the rows next to a slab are
+// copied in as halos, the owned particles are moved
+// in one fused pass and the ones that left the slab
+// migrate to their new owner.
+//
+// the boxes, the order of the particles in them and
+// the noise stream are the same as in entbody_step,
+// so the trajectory matches the single process run.
+// ranks on one host talk through MPI's shared memory
+// transport
+//===================================================
+#define DOMAIN_PACK 7   // gid, x[2], v[2], type, col
+
+typedef struct {
+    entbody_t *s;       // parameters, clock and the noise stream
+    MPI_Comm comm;
+    int  rank, nranks;
+    int  rows;          // rows of boxes in the whole box
+    int  row0, row1;    // owned rows [row0, row1)
+    int  lrows;         // rows held locally, owned and halo
+
+    long n;             // owned particles, then nhalo halos
+    long nhalo;
+    long cap;
+    long   *gid;
+    double *x, *v, *xn, *vn;
+    double *col;
+    int    *type;
+
+    long   nred;
+    long   *redrank;    // [N] order among the RED particles, -1 for BLACK
+    double *noise;      // [nred][2] uniform draws for this step
+
+    int  *count;        // [lrows*size[0]]
+    int  *start;
+    int  *cells;
+
+    double *sendbuf, *recvbuf;
+    long sendcap, recvcap;
+    int  *scount, *sdispl, *rcount, *rdispl;
+} domain_t;
+
+int  domain_init(domain_t *d, entbody_t *s, MPI_Comm comm);
+void domain_free(domain_t *d);
+void domain_step(domain_t *d);
+void domain_observe(domain_t *d, entbody_obs_t *obs);
+void domain_gather(domain_t *d);
+
+#endif
@@ -0,0 +1,1146 @@
+//===================================================
+// Author: Matthew Bierbaum
+// Project: Collective motion at heavy metal concerts
+//===================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include "entbody_internal.h"
+
+#ifdef OPENMP
+#include <omp.h>
+#endif
+
+#define EPSILON DBL_EPSILON
+#define DENSITY_BOXES_MAX 1024
+#define CELLS_MAX 46340             // boxes a side whose keys fit an int
+
+int entbody_abi_version(){
+    return ENTBODY_ABI_VERSION;
+}
+
+//==================================================
+// creation and destruction
+//==================================================
+// the per thread part of n elements of elem bytes
+// under schedule(static)
+static size_t thread_slice(long n, size_t elem){
+    int nth = 1;
+    #ifdef OPENMP
+    nth = omp_get_max_threads();
+    #endif
+    return n*elem / nth;
+}
+
+entbody_t *entbody_create(long N, double alphain, double sigmain, int seed, double dampin){
+    int RIC = 0;
+    int i;
+
+    entbody_t *s = (entbody_t*)malloc(sizeof(entbody_t));
+    ran_seed(s, seed);
+
+    s->N       = N;
+    s->radius  = 1.0;
+    s->L       = 1.03*sqrt(pi*s->radius*s->radius*N);
+
+    s->pbc[0] = s->pbc[1] = 1;
+
+    s->epsilon = 25.0;
+    s->sigma   = sigmain;
+    s->alpha   = alphain;
+
+    s->vhappy_black = 0.0;
+    s->vhappy_red   = 1.0;
+    s->damp_coeff   = dampin;
+
+    s->dt  = 1e-1;
+    s->t   = 0.0;
+    s->R   = 2*s->radius;
+    s->R2  = s->R*s->R;
+    s->FR  = 2*s->R;
+    s->FR2 = s->FR*s->FR;
+
+    s->step = 0;
+    s->hold = 0;
+    s->fused = 0;
+
+    //-------------------------------------------------
+    // the particle arrays share one arena, each on pages
+    // of its own, first touched by the threads that own
+    // the particles in the force loop.  the static slices
+    // are not page aligned, so the one page at each edge
+    // of a slice may land with the neighbouring thread.
+    // the scratch of the step lives in a second arena,
+    // made at the first step for the mode in use
+    arena_init(&s->parena, 3*2*N*sizeof(double) + 2*N*sizeof(double) +
+                           2*N*sizeof(int), 7, thread_slice(N, sizeof(int)));
+    s->x = (double*)arena_carve(&s->parena, 2*N*sizeof(double));
+    s->v = (double*)arena_carve(&s->parena, 2*N*sizeof(double));
+    s->o = (double*)arena_carve(&s->parena, 2*N*sizeof(double));
+    s->rad    = (double*)arena_carve(&s->parena, N*sizeof(double));
+    s->col    = (double*)arena_carve(&s->parena, N*sizeof(double));
+    s->type   = (int*)arena_carve(&s->parena, N*sizeof(int));
+    s->cellid = (int*)arena_carve(&s->parena, N*sizeof(int));
+
+    #ifdef OPENMP
+    #pragma omp parallel for schedule(static)
+    #endif
+    for (i=0; i<N; i++){
+        s->x[2*i+0] = s->x[2*i+1] = 0.0;
+        s->v[2*i+0] = s->v[2*i+1] = 0.0;
+        s->o[2*i+0] = s->o[2*i+1] = 0.0;
+        s->rad[i] = s->col[i] = 0.0;
+        s->type[i] = s->cellid[i] = 0;
+    }
+
+    s->marena.base = NULL;
+    s->f = s->w = s->x2 = s->v2 = NULL;
+    s->neigh = NULL;
+
+    //-------------------------------------------------
+    // initialize
+    for (i=0; i<N; i++)
+        s->rad[i] = s->radius;
+
+    if (RIC)
+        init_random(s, s->vhappy_red);
+    else
+        init_circle(s, s->vhappy_red);
+
+    //-------------------------------------------------------
+    // make boxes for the neighborlist
+    s->hist_threads = 0;
+    s->hist = NULL;
+    s->hashed = 0;
+    s->carena.base = NULL;
+    entbody_set_cells(s, (int)(s->L / (s->FR)));
+    return s;
+}
+
+//==================================================
+// (re)make the boxes for the neighborlist with ncell
+// boxes per side.  the boxes must be at least FR wide
+// and at least 3 per side for the 3x3 stencil.  NMAX
+// grows with the box area from 50 at the default size.
+// box keys are ints, so no more than CELLS_MAX per side
+//==================================================
+int entbody_set_cells(entbody_t *s, int ncell){
+    int i;
+    if (s->L / s->FR > CELLS_MAX + 1)
+        return 0;
+    int nmax = (int)(s->L / (s->FR));
+    if (ncell > nmax || ncell < 3 || ncell > CELLS_MAX)
+        return 0;
+
+    double edge    = s->L / ncell;
+    double edge0   = s->L / nmax;
+    s->NMAX = (int)(50 * (edge*edge) / (edge0*edge0) + 0.5);
+
+    s->size_total = 1;
+    for (i=0; i<2; i++){
+        s->size[i] = ncell;
+        s->size_total *= s->size[i];
+    }
+
+    if (s->carena.base)
+        arena_free(&s->carena);
+
+    // the hashed grid only holds the occupied boxes, so its
+    // size follows N rather than the area
+    if (s->hashed){
+        long N = s->N;
+        for (s->hcap=16; s->hcap < 2*N; s->hcap *= 2);
+        arena_init(&s->carena, 2*s->hcap*sizeof(int) + (4*N+1)*sizeof(int),
+                   6, thread_slice(N, sizeof(int)));
+        s->hkey   = (int*)arena_carve(&s->carena, s->hcap*sizeof(int));
+        s->hslot  = (int*)arena_carve(&s->carena, s->hcap*sizeof(int));
+        s->hstart = (int*)arena_carve(&s->carena, (N+1)*sizeof(int));
+        s->hfill  = (int*)arena_carve(&s->carena, N*sizeof(int));
+        s->hpart  = (int*)arena_carve(&s->carena, N*sizeof(int));
+        s->hcells = (int*)arena_carve(&s->carena, N*sizeof(int));
+        s->count = s->cells = NULL;
+        for (i=0; i<s->hcap; i++)
+            s->hkey[i] = -1;
+        s->hstart[0] = 0;
+
+        free(s->hist);
+        s->hist = NULL;
+        s->hist_threads = 0;
+        return 1;
+    }
+
+    arena_init(&s->carena, s->size_total*(s->NMAX+1)*sizeof(int),
+               2, thread_slice(s->size_total, sizeof(int)));
+    s->count = (int*)arena_carve(&s->carena, s->size_total*sizeof(int));
+    s->cells = (int*)arena_carve(&s->carena, s->size_total*s->NMAX*sizeof(int));
+
+    // the boxes are filled and read by the threads that own
+    // the particles in them, so first touch them along the
+    // particle partition rather than by box index.  the
+    // particles are not sorted in space: a page of boxes is
+    // wanted by several threads and lands with the first,
+    // boxes that start empty are placed by the first bin, and
+    // the owners drift as the crowd moves.  that is the cost
+    // of keeping a single grid instead of one per socket
+    long n;
+    #ifdef OPENMP
+    #pragma omp parallel for schedule(static)
+    #endif
+    for (n=0; n<s->N; n++){
+        int index[2];
+        coords_to_index(&s->x[2*n], s->size, index, s->L);
+        int c = index[0] + index[1]*s->size[0];
+        __atomic_store_n(&s->count[c], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->cells[s->NMAX*c], 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->cells[s->NMAX*c + s->NMAX-1], 0, __ATOMIC_RELAXED);
+    }
+
+    free(s->hist);
+    s->hist = NULL;
+    s->hist_threads = 0;
+    return 1;
+}
+
+// switch between the dense and the hashed box grid, keeping
+// the box size
+void entbody_set_grid(entbody_t *s, int hashed){
+    s->hashed = hashed;
+    entbody_set_cells(s, s->size[0]);
+}
+
+// rescale the box and the positions to a packing fraction phi,
+// refusing it before anything moves if the boxes would not fit
+int entbody_set_packing(entbody_t *s, double phi){
+    long i;
+    if (phi <= 0.0 || phi > 1.0)
+        return 0;
+    double L = sqrt(pi*s->radius*s->radius*s->N / phi);
+    if (L < 3*s->FR || L / s->FR >= CELLS_MAX + 1)
+        return 0;
+
+    for (i=0; i<2*s->N; i++){
+        s->x[i] *= L / s->L;
+        if (s->x[i] >= L) s->x[i] = mymod(s->x[i], L);
+    }
+    s->L = L;
+    return entbody_set_cells(s, (int)(s->L / (s->FR)));
+}
+
+void entbody_destroy(entbody_t *s){
+    arena_free(&s->carena);
+    if (s->marena.base)
+        arena_free(&s->marena);
+    arena_free(&s->parena);
+    free(s->hist);
+    free(s);
+}
+
+//==================================================
+// fill the cell neighbor locator.  in parallel this is
+// a two pass counting sort: each thread histograms a
+// contiguous block of particles, a prefix sum over the
+// threads gives every block its slots in each cell,
+// and the blocks scatter in order.  the cells end up
+// with exactly the contents of the serial loop
+//==================================================
+static void entbody_bin_hashed(entbody_t *s);
+
+void entbody_bin(entbody_t *s){
+    if (s->hashed){
+        entbody_bin_hashed(s);
+        return;
+    }
+
+    long N = s->N;
+    int NMAX = s->NMAX;
+    double L = s->L;
+    int *size   = s->size;
+    int *count  = s->count;
+    int *cells  = s->cells;
+    int *cellid = s->cellid;
+    double *x   = s->x;
+    int size_total = s->size_total;
+    int index[2];
+    long i;
+
+    #ifdef OPENMP
+    int nth = omp_get_max_threads();
+    if (nth > s->hist_threads){
+        free(s->hist);
+        s->hist = (int*)malloc(sizeof(int)*nth*size_total);
+        s->hist_threads = nth;
+    }
+    int *hist = s->hist;
+
+    #pragma omp parallel num_threads(nth) private(i,index)
+    {
+        int tid = omp_get_thread_num();
+        int nt  = omp_get_num_threads();
+        int *mine = &hist[tid*size_total];
+        long lo = N*tid/nt;
+        long hi = N*(tid+1)/nt;
+        int c, th;
+
+        for (c=0; c<size_total; c++)
+            mine[c] = 0;
+
+        for (i=lo; i<hi; i++){
+            coords_to_index(&x[2*i], size, index, L);
+            cellid[i] = index[0] + index[1]*size[0];
+            mine[cellid[i]]++;
+        }
+        #pragma omp barrier
+
+        #pragma omp for
+        for (c=0; c<size_total; c++){
+            int run = 0;
+            for (th=0; th<nt; th++){
+                int h = hist[th*size_total + c];
+                hist[th*size_total + c] = run;
+                run += h;
+            }
+            count[c] = run;
+        }
+
+        for (i=lo; i<hi; i++){
+            int t = cellid[i];
+            cells[NMAX*t + mine[t]] = i;
+            mine[t]++;
+        }
+    }
+    #else
+    for (i=0; i<size_total; i++)
+        count[i] = 0;
+
+    for (i=0; i<N; i++){
+        coords_to_index(&x[2*i], size, index, L);
+        int t = index[0] + index[1]*size[0];
+        cellid[i] = t;
+        cells[NMAX*t + count[t]] = i;
+        count[t]++;
+    }
+    #endif
+}
+
+//==================================================
+// the hashed version: only the boxes that hold a
+// particle get a slot, numbered in the order they are
+// first seen, and the members are sorted by slot with
+// a counting sort so each box is in index order as in
+// the dense grid.  clearing is over the table, O(N)
+//==================================================
+static void entbody_bin_hashed(entbody_t *s){
+    long N = s->N;
+    long mask = s->hcap - 1;
+    int index[2];
+    long i, h;
+    int nslots = 0, k;
+
+    for (h=0; h<s->hcap; h++)
+        s->hkey[h] = -1;
+
+    for (i=0; i<N; i++){
+        coords_to_index(&s->x[2*i], s->size, index, s->L);
+        int t = index[0] + index[1]*s->size[0];
+        s->cellid[i] = t;
+
+        h = ((unsigned int)t * 2654435761u) & mask;
+        while (s->hkey[h] >= 0 && s->hkey[h] != t)
+            h = (h+1) & mask;
+        if (s->hkey[h] < 0){
+            s->hkey[h]  = t;
+            s->hslot[h] = nslots;
+            s->hfill[nslots++] = 0;
+        }
+        s->hpart[i] = s->hslot[h];
+        s->hfill[s->hpart[i]]++;
+    }
+
+    for (k=0; k<nslots; k++){
+        s->hstart[k+1] = s->hstart[k] + s->hfill[k];
+        s->hfill[k] = s->hstart[k];
+    }
+    for (i=0; i<N; i++)
+        s->hcells[s->hfill[s->hpart[i]]++] = i;
+}
+
+//==================================================
+// a single time step: bin, find forces, integrate
+//==================================================
+static void entbody_step_one(entbody_t *s){
+    long N = s->N;
+    double L = s->L;
+    int *pbc = s->pbc;
+
+    double epsilon = s->epsilon;
+    double sigma   = s->sigma;
+    double alpha   = s->alpha;
+    double vhappy_black = s->vhappy_black;
+    double vhappy_red   = s->vhappy_red;
+    double damp_coeff   = s->damp_coeff;
+
+    double dt  = s->dt;
+    double R   = s->R;
+    double R2  = s->R2;
+    double FR2 = s->FR2;
+
+    int *type   = s->type;
+    int *neigh  = s->neigh;
+    double *col = s->col;
+    double *x = s->x;
+    double *v = s->v;
+    double *f = s->f;
+    double *w = s->w;
+    double *o = s->o;
+
+    int *size  = s->size;
+
+    int i, j, k;
+    int index[2];
+    entbody_bin(s);
+
+    int tt[2];
+    int tix[2];
+    int image[2];
+    double dx[2];
+    int goodcell, ind, n;
+    double r0, l, co, co1, dist;
+    double wlen, vlen, vhappy;
+
+    #ifdef OPENMP
+    #pragma omp parallel for schedule(static) private(i,dx,index,tt,goodcell,tix,ind,j,n,image,k,dist,r0,l,co,co1,wlen,vlen,vhappy)
+    #endif
+    for (i=0; i<N; i++){
+        f[2*i+0] = 0.0;
+        f[2*i+1] = 0.0;
+        w[2*i+0] = 0.0;
+        w[2*i+1] = 0.0;
+        neigh[i] = 0;
+
+        coords_to_index(&x[2*i], size, index, L);
+
+        for (tt[0]=-1; tt[0]<=1; tt[0]++){
+        for (tt[1]=-1; tt[1]<=1; tt[1]++){
+            goodcell = 1;
+            for (j=0; j<2; j++){
+                tix[j] = mod_rvec(index[j]+tt[j],size[j]-1,pbc[j],&image[j]);
+                if (pbc[j] < image[j])
+                    goodcell=0;
+            }
+
+            if (goodcell){
+                ind = tix[0] + tix[1]*size[0];
+
+                int *list;
+                int nlist = cell_list(s, ind, &list);
+                for (j=0; j<nlist; j++){
+                    n = list[j];
+
+                    dist = 0.0;
+                    for (k=0; k<2; k++){
+                        dx[k] = x[2*n+k] - x[2*i+k];
+
+                        if (image[k])
+                            dx[k] += L*tt[k];
+                        dist += dx[k]*dx[k];
+                    }
+
+                    //===============================================
+                    // force calculation - hertz
+                    if (dist > 1e-10 && dist < R2){
+                        r0 = R;
+                        l  = sqrt(dist);
+                        co1 = (1-l/r0);
+                        co = epsilon * co1*sqrt(co1) * (l<r0);
+                        for (k=0; k<2; k++){
+                            f[2*i+k] += - dx[k]/l * co;
+                            col[i] += co*co*dx[k]*dx[k]/dist;
+                        }
+                    }
+                    //===============================================
+                    // add up the neighbor veocities
+                    if (dist > 1e-10 && dist < FR2 && type[n] == RED && type[i] == RED){
+                         for (k=0; k<2; k++)
+                            w[2*i+k] += v[2*n+k];
+                        neigh[i]++;
+                    }
+                }
+            }
+        } }
+
+        //=====================================
+        // flocking force
+        wlen = sqrt(w[2*i+0]*w[2*i+0] + w[2*i+1]*w[2*i+1]);
+        if (type[i] == RED && neigh[i] > 0 && wlen > 1e-6){
+            f[2*i+0] += alpha * w[2*i+0] / wlen;
+            f[2*i+1] += alpha * w[2*i+1] / wlen;
+        }
+
+        //====================================
+        // self-propulsion
+        vlen = sqrt(v[2*i+0]*v[2*i+0] + v[2*i+1]*v[2*i+1]);
+        vhappy = type[i]==RED?vhappy_red:vhappy_black;
+        if (vlen > 1e-6){
+            f[2*i+0] += damp_coeff*(vhappy - vlen)*v[2*i+0]/vlen;
+            f[2*i+1] += damp_coeff*(vhappy - vlen)*v[2*i+1]/vlen;
+        }
+
+        //=======================================
+        // noise term
+        if (type[i] == RED){
+            // Box-Muller method
+            double u1 = ran_ran2(s);
+            double u2 = 2*pi*ran_ran2(s);
+            double lfac = sqrt(-2*log(u1));
+            f[2*i+0] += sigma*lfac*cos(u2);
+            f[2*i+1] += sigma*lfac*sin(u2);
+        }
+
+        //=====================================
+        // kick force
+        f[2*i+0] += o[2*i+0]; o[2*i+0] = 0.0;
+        f[2*i+1] += o[2*i+1]; o[2*i+1] = 0.0;
+    }
+    #ifdef OPENMP
+    #pragma omp barrier
+    #endif
+
+    // now integrate the forces since we have found them
+    #ifdef OPENMP
+    #pragma omp parallel for schedule(static) private(j)
+    #endif
+    for (i=0; i<N;i++){
+        // Newton-Stomer-Verlet
+        if (!s->hold){
+            v[2*i+0] += f[2*i+0] * dt;
+            v[2*i+1] += f[2*i+1] * dt;
+
+            x[2*i+0] += v[2*i+0] * dt;
+            x[2*i+1] += v[2*i+1] * dt;
+        }
+
+        // boundary conditions
+        for (j=0; j<2; j++){
+            if (pbc[j] == 1){
+                if (x[2*i+j] >= L-EPSILON || x[2*i+j] < 0)
+                    x[2*i+j] = mymod(x[2*i+j], L);
+            }
+            else {
+                const double restoration = 1.0;
+                if (x[2*i+j] >= L){x[2*i+j] = 2*L-x[2*i+j]; v[2*i+j] *= -restoration;}
+                if (x[2*i+j] < 0) {x[2*i+j] = -x[2*i+j];    v[2*i+j] *= -restoration;}
+                if (x[2*i+j] >= L-EPSILON || x[2*i+j] < 0){x[2*i+j] = mymod(x[2*i+j], L);}
+            }
+        }
+
+        // just check for errors
+        if (x[2*i+0] >= L || x[2*i+0] < 0.0 ||
+            x[2*i+1] >= L || x[2*i+1] < 0.0)
+            printf("out of bounds\n");
+
+        col[i] = col[i]/12;
+    }
+    #ifdef OPENMP
+    #pragma omp barrier
+    #endif
+
+    s->t += dt;
+    s->step++;
+}
+
+//==================================================
+// the same step in a single pass.  the forces are
+// kept in registers and each particle is integrated
+// straight into the second buffer, so the neighbors
+// still see the old state and the result is the same
+// as the two pass step without the f, w and neigh
+// traffic or the second sweep over x and v
+//==================================================
+static void entbody_step_fused(entbody_t *s){
+    long N = s->N;
+    double L = s->L;
+    int *pbc = s->pbc;
+
+    double epsilon = s->epsilon;
+    double sigma   = s->sigma;
+    double alpha   = s->alpha;
+    double vhappy_black = s->vhappy_black;
+    double vhappy_red   = s->vhappy_red;
+    double damp_coeff   = s->damp_coeff;
+
+    double dt  = s->dt;
+    double R   = s->R;
+    double R2  = s->R2;
+    double FR2 = s->FR2;
+    int hold   = s->hold;
+
+    int *type   = s->type;
+    double *col = s->col;
+    double *x  = s->x;
+    double *v  = s->v;
+    double *xn = s->x2;
+    double *vn = s->v2;
+    double *o  = s->o;
+
+    int *size  = s->size;
+
+    int i;
+    entbody_bin(s);
+
+    #ifdef OPENMP
+    #pragma omp parallel for schedule(static)
+    #endif
+    for (i=0; i<N; i++){
+        int j, k, n, ind, goodcell, nn = 0;
+        int index[2], tt[2], tix[2], image[2];
+        double dx[2], fi[2] = {0.0, 0.0}, wi[2] = {0.0, 0.0};
+        double r0, l, co, co1, dist, wlen, vlen, vhappy;
+        double ci = col[i];
+
+        coords_to_index(&x[2*i], size, index, L);
+
+        for (tt[0]=-1; tt[0]<=1; tt[0]++){
+        for (tt[1]=-1; tt[1]<=1; tt[1]++){
+            goodcell = 1;
+            for (j=0; j<2; j++){
+                tix[j] = mod_rvec(index[j]+tt[j],size[j]-1,pbc[j],&image[j]);
+                if (pbc[j] < image[j])
+                    goodcell=0;
+            }
+
+            if (goodcell){
+                ind = tix[0] + tix[1]*size[0];
+
+                int *list;
+                int nlist = cell_list(s, ind, &list);
+                for (j=0; j<nlist; j++){
+                    n = list[j];
+
+                    dist = 0.0;
+                    for (k=0; k<2; k++){
+                        dx[k] = x[2*n+k] - x[2*i+k];
+
+                        if (image[k])
+                            dx[k] += L*tt[k];
+                        dist += dx[k]*dx[k];
+                    }
+
+                    if (dist > 1e-10 && dist < R2){
+                        r0 = R;
+                        l  = sqrt(dist);
+                        co1 = (1-l/r0);
+                        co = epsilon * co1*sqrt(co1) * (l<r0);
+                        for (k=0; k<2; k++){
+                            fi[k] += - dx[k]/l * co;
+                            ci += co*co*dx[k]*dx[k]/dist;
+                        }
+                    }
+                    if (dist > 1e-10 && dist < FR2 && type[n] == RED && type[i] == RED){
+                        for (k=0; k<2; k++)
+                            wi[k] += v[2*n+k];
+                        nn++;
+                    }
+                }
+            }
+        } }
+
+        wlen = sqrt(wi[0]*wi[0] + wi[1]*wi[1]);
+        if (type[i] == RED && nn > 0 && wlen > 1e-6){
+            fi[0] += alpha * wi[0] / wlen;
+            fi[1] += alpha * wi[1] / wlen;
+        }
+
+        vlen = sqrt(v[2*i+0]*v[2*i+0] + v[2*i+1]*v[2*i+1]);
+        vhappy = type[i]==RED?vhappy_red:vhappy_black;
+        if (vlen > 1e-6){
+            fi[0] += damp_coeff*(vhappy - vlen)*v[2*i+0]/vlen;
+            fi[1] += damp_coeff*(vhappy - vlen)*v[2*i+1]/vlen;
+        }
+
+        if (type[i] == RED){
+            double u1 = ran_ran2(s);
+            double u2 = 2*pi*ran_ran2(s);
+            double lfac = sqrt(-2*log(u1));
+            fi[0] += sigma*lfac*cos(u2);
+            fi[1] += sigma*lfac*sin(u2);
+        }
+
+        fi[0] += o[2*i+0]; o[2*i+0] = 0.0;
+        fi[1] += o[2*i+1]; o[2*i+1] = 0.0;
+
+        //=======================================
+        // integrate into the other buffer
+        for (j=0; j<2; j++){
+            vn[2*i+j] = v[2*i+j];
+            xn[2*i+j] = x[2*i+j];
+            if (!hold){
+                vn[2*i+j] += fi[j] * dt;
+                xn[2*i+j] += vn[2*i+j] * dt;
+            }
+
+            if (pbc[j] == 1){
+                if (xn[2*i+j] >= L-EPSILON || xn[2*i+j] < 0)
+                    xn[2*i+j] = mymod(xn[2*i+j], L);
+            }
+            else {
+                const double restoration = 1.0;
+                if (xn[2*i+j] >= L){xn[2*i+j] = 2*L-xn[2*i+j]; vn[2*i+j] *= -restoration;}
+                if (xn[2*i+j] < 0) {xn[2*i+j] = -xn[2*i+j];    vn[2*i+j] *= -restoration;}
+                if (xn[2*i+j] >= L-EPSILON || xn[2*i+j] < 0){xn[2*i+j] = mymod(xn[2*i+j], L);}
+            }
+        }
+
+        if (xn[2*i+0] >= L || xn[2*i+0] < 0.0 ||
+            xn[2*i+1] >= L || xn[2*i+1] < 0.0)
+            printf("out of bounds\n");
+
+        col[i] = ci/12;
+    }
+
+    s->x  = xn;  s->x2 = x;
+    s->v  = vn;  s->v2 = v;
+    s->t += dt;
+    s->step++;
+}
+
+static void entbody_scratch(entbody_t *s);
+
+void entbody_step(entbody_t *s, long nsteps){
+    long n;
+    if (!s->marena.base && nsteps > 0)
+        entbody_scratch(s);
+    for (n=0; n<nsteps; n++){
+        if (s->fused)
+            entbody_step_fused(s);
+        else
+            entbody_step_one(s);
+    }
+}
+
+//==================================================
+// the scratch of each step mode: f, w and neigh for
+// the two pass step, the x2/v2 halves of the double
+// buffer for the fused one.  only the mode in use is
+// allocated, at its first step, and a switch of mode
+// drops it.  after an odd number of fused steps x and
+// v live in the scratch, so they are copied home first
+//==================================================
+static int in_arena(arena_t *a, void *p){
+    return a->base && (char*)p >= a->base && (char*)p < a->base + a->bytes;
+}
+
+static void entbody_scratch(entbody_t *s){
+    long N = s->N;
+    long i;
+
+    if (s->fused){
+        arena_init(&s->marena, 2*2*N*sizeof(double), 2, thread_slice(2*N, sizeof(double)));
+        s->x2 = (double*)arena_carve(&s->marena, 2*N*sizeof(double));
+        s->v2 = (double*)arena_carve(&s->marena, 2*N*sizeof(double));
+
+        #ifdef OPENMP
+        #pragma omp parallel for schedule(static)
+        #endif
+        for (i=0; i<N; i++){
+            s->x2[2*i+0] = s->x2[2*i+1] = 0.0;
+            s->v2[2*i+0] = s->v2[2*i+1] = 0.0;
+        }
+        return;
+    }
+
+    arena_init(&s->marena, 2*2*N*sizeof(double) + N*sizeof(int), 3, thread_slice(N, sizeof(int)));
+    s->f = (double*)arena_carve(&s->marena, 2*N*sizeof(double));
+    s->w = (double*)arena_carve(&s->marena, 2*N*sizeof(double));
+    s->neigh = (int*)arena_carve(&s->marena, N*sizeof(int));
+
+    #ifdef OPENMP
+    #pragma omp parallel for schedule(static)
+    #endif
+    for (i=0; i<N; i++){
+        s->f[2*i+0] = s->f[2*i+1] = 0.0;
+        s->w[2*i+0] = s->w[2*i+1] = 0.0;
+        s->neigh[i] = 0;
+    }
+}
+
+void entbody_set_fused(entbody_t *s, int fused){
+    if (fused == s->fused)
+        return;
+
+    if (s->marena.base){
+        if (in_arena(&s->marena, s->x)){
+            memcpy(s->x2, s->x, sizeof(double)*2*s->N);
+            memcpy(s->v2, s->v, sizeof(double)*2*s->N);
+            s->x = s->x2;
+            s->v = s->v2;
+        }
+        arena_free(&s->marena);
+    }
+    s->f = s->w = s->x2 = s->v2 = NULL;
+    s->neigh = NULL;
+    s->fused = fused;
+}
+
+//==================================================
+// access to the state and the observables
+//==================================================
+void entbody_view(entbody_t *s, entbody_view_t *view){
+    view->N      = s->N;
+    view->L      = s->L;
+    view->t      = s->t;
+    view->dt     = s->dt;
+    view->step   = s->step;
+    view->pbc[0] = s->pbc[0];
+    view->pbc[1] = s->pbc[1];
+    view->x      = s->x;
+    view->v      = s->v;
+    view->rad    = s->rad;
+    view->col    = s->col;
+    view->type   = s->type;
+}
+
+void entbody_observe(entbody_t *s, entbody_obs_t *obs){
+    int i;
+    double linearmomx = 0.0;
+    double linearmomy = 0.0;
+    int linearmomc = 0;
+    for (i=0; i<s->N; i++){
+        if (s->type[i] == RED){
+            linearmomx += s->v[2*i+0];
+            linearmomy += s->v[2*i+1];
+            linearmomc++;
+        }
+    }
+
+    obs->t          = s->t;
+    obs->angularmom = angularmom(s->x, s->v, s->type, s->N, s->L, s->pbc);
+    obs->momentumx  = linearmomx / linearmomc;
+    obs->momentumy  = linearmomy / linearmomc;
+    centerofmass(s->x, s->type, s->N, s->L, &obs->cmx, &obs->cmy);
+}
+
+// bins is [RADS][BINS], accumulated in place
+void entbody_temperature(entbody_t *s, int *bins){
+    temperature(s->x, s->v, s->type, s->N, s->L, s->pbc, (int (*)[BINS])bins);
+}
+
+// RED and BLACK counts and mean velocity on a grid of the
+// neighbor boxes, coarsened to at most DENSITY_BOXES_MAX a
+// side so a dilute arena does not draw millions of boxes.
+// out is [4][ny][nx] or NULL for the sizes only.  binned
+// from the positions, so the boxes of the last step (which
+// predate its moves, or do not exist yet) are not needed
+int entbody_density(entbody_t *s, int *nx, int *ny, float *out){
+    int bx = s->size[0] < DENSITY_BOXES_MAX ? s->size[0] : DENSITY_BOXES_MAX;
+    int by = s->size[1] < DENSITY_BOXES_MAX ? s->size[1] : DENSITY_BOXES_MAX;
+    int n = bx*by;
+    long i;
+    int c;
+    *nx = bx;
+    *ny = by;
+    if (!out) return n;
+
+    memset(out, 0, sizeof(float)*4*n);
+    for (i=0; i<s->N; i++){
+        double px = s->x[2*i+0] / s->L * bx;
+        double py = s->x[2*i+1] / s->L * by;
+        int cx = px > 0 ? (px < bx ? (int)px : bx-1) : 0;
+        int cy = py > 0 ? (py < by ? (int)py : by-1) : 0;
+        c = cx + cy*bx;
+        out[(s->type[i] == RED ? 0 : 1)*n + c] += 1;
+        out[2*n+c] += s->v[2*i+0];
+        out[3*n+c] += s->v[2*i+1];
+    }
+    for (c=0; c<n; c++){
+        float count = out[0*n+c] + out[1*n+c];
+        if (count > 0){
+            out[2*n+c] /= count;
+            out[3*n+c] /= count;
+        }
+    }
+    return n;
+}
+
+void entbody_hold(entbody_t *s, int hold){
+    s->hold = hold;
+}
+
+void entbody_set_speed(entbody_t *s, int type, double vhappy){
+    if (type == RED)
+        s->vhappy_red = vhappy;
+    else
+        s->vhappy_black = vhappy;
+}
+
+void entbody_kick(entbody_t *s, double fx, double fy){
+    int i;
+    for (i=0; i<s->N; i++){
+        if (s->type[i] == RED){
+            if (fx != 0.0) s->o[2*i+0] = fx;
+            if (fy != 0.0) s->o[2*i+1] = fy;
+        }
+    }
+}
+
+//==================================================
+// state files for continuation.  only the particles
+// are stored; the parameters and the random stream
+// belong to the instance that loads them, and its
+// clock starts again from zero
+//==================================================
+#define STATE_MAGIC 0x42544e45
+
+int entbody_save(entbody_t *s, const char *filename){
+    FILE *file = fopen(filename, "wb");
+    if (!file) return 0;
+
+    int magic = STATE_MAGIC;
+    fwrite(&magic, sizeof(int), 1, file);
+    fwrite(&s->N, sizeof(long), 1, file);
+    fwrite(&s->L, sizeof(double), 1, file);
+    fwrite(&s->t, sizeof(double), 1, file);
+    fwrite(s->x, sizeof(double), 2*s->N, file);
+    fwrite(s->v, sizeof(double), 2*s->N, file);
+    fwrite(s->type, sizeof(int), s->N, file);
+    return fclose(file) == 0;
+}
+
+int entbody_load(entbody_t *s, const char *filename){
+    FILE *file = fopen(filename, "rb");
+    if (!file) return 0;
+
+    int magic = 0;
+    long N = 0;
+    double L = 0.0, t = 0.0;
+    int good = fread(&magic, sizeof(int), 1, file) == 1 &&
+               fread(&N, sizeof(long), 1, file) == 1 &&
+               fread(&L, sizeof(double), 1, file) == 1 &&
+               fread(&t, sizeof(double), 1, file) == 1 &&
+               magic == STATE_MAGIC && N == s->N && L == s->L;
+
+    // read into temporaries so a short file leaves s untouched
+    double *x = NULL, *v = NULL;
+    int *type = NULL;
+    if (good){
+        x    = (double*)malloc(sizeof(double)*2*N);
+        v    = (double*)malloc(sizeof(double)*2*N);
+        type = (int*)malloc(sizeof(int)*N);
+        good = fread(x, sizeof(double), 2*N, file) == (size_t)(2*N) &&
+               fread(v, sizeof(double), 2*N, file) == (size_t)(2*N) &&
+               fread(type, sizeof(int), N, file) == (size_t)N;
+    }
+    fclose(file);
+
+    if (good){
+        memcpy(s->x, x, sizeof(double)*2*N);
+        memcpy(s->v, v, sizeof(double)*2*N);
+        memcpy(s->type, type, sizeof(int)*N);
+        memset(s->o, 0, sizeof(double)*2*N);
+    }
+    free(x);
+    free(v);
+    free(type);
+    if (!good) return 0;
+
+    s->t = 0.0;
+    s->step = 0;
+    ran_seed(s, s->vseed);
+    return 1;
+}
+
+
+
+
+//=================================================
+// extra stuff
+//=================================================
+void ran_seed(entbody_t *s, long j){
+  s->vseed = j;  s->vran = 4101842887655102017LL;
+  s->vran ^= s->vseed;
+  s->vran ^= s->vran >> 21; s->vran ^= s->vran << 35; s->vran ^= s->vran >> 4;
+  s->vran = s->vran * 2685821657736338717LL;
+}
+
+double ran_ran2(entbody_t *s){
+    s->vran ^= s->vran >> 21; s->vran ^= s->vran << 35; s->vran ^= s->vran >> 4;
+    unsigned long long int t = s->vran * 2685821657736338717LL;
+    return 5.42101086242752217e-20*t;
+}
+
+void init_circle(entbody_t *s, double speed){
+    double *x = s->x;
+    double *v = s->v;
+    int *type = s->type;
+    double L  = s->L;
+    int i;
+    for (i=0; i<s->N; i++){
+        double tx = L*ran_ran2(s);
+        double ty = L*ran_ran2(s);
+        double tt = 2*pi*ran_ran2(s);
+
+        x[2*i+0] = tx;
+        x[2*i+1] = ty;
+
+        // the radius for which 30% of the particles are red on avg
+        double dd = sqrt((tx-L/2)*(tx-L/2) + (ty-L/2)*(ty-L/2));
+        double rad = sqrt(0.16*L*L / pi);
+
+        //if (i<0.15*N)
+        if (dd < rad)
+            type[i] = RED;
+        else
+            type[i] = BLACK;
+
+        if (type[i] == RED){
+            v[2*i+0] = speed*cos(tt);
+            v[2*i+1] = speed*sin(tt);
+        }
+        else {
+            v[2*i+0] = 0.0;
+            v[2*i+1] = 0.0;
+        }
+    }
+}
+
+void init_random(entbody_t *s, double speed){
+    double *x = s->x;
+    double *v = s->v;
+    int *type = s->type;
+    double L  = s->L;
+    int i;
+    for (i=0; i<s->N; i++){
+        double t = 2*pi*ran_ran2(s);
+
+        x[2*i+0] = L*ran_ran2(s);
+        x[2*i+1] = L*ran_ran2(s);
+
+        if (ran_ran2(s) > 0.16){
+            v[2*i+0] = 0.0;
+            v[2*i+1] = 0.0;
+            type[i] = BLACK;
+        }
+        else {
+            v[2*i+0] = speed * sin(t);
+            v[2*i+1] = speed * cos(t);
+            type[i] = RED;
+        }
+    }
+}
+
+//=======================================
+// NBL - neighborlist helper functions
+//=======================================
+inline double mymod(double a, double b){
+  return a - b*(int)(a/b) + b*(a<0);
+}
+
+inline void coords_to_index(double *x, int *size, int *index, double L){
+    index[0] = (int)(x[0]/L  * size[0]);
+    index[1] = (int)(x[1]/L  * size[1]);
+}
+
+inline int mod_rvec(int a, int b, int p, int *image){
+    *image = 1;
+    if (b==0) {if (a==0) *image=0; return 0;}
+    if (p != 0){
+        if (a>b)  return a-b-1;
+        if (a<0)  return a+b+1;
+    } else {
+        if (a>b)  return b;
+        if (a<0)  return 0;
+    }
+    *image = 0;
+    return a;
+}
+
+
+
+//==========================================
+// measurement functions
+//=========================================
+void centerofmass(double *x, int *t, int N, double L, double *cmx, double *cmy){
+    int i;
+    double xreal = 0.0;
+    double ximag = 0.0;
+    double yreal = 0.0;
+    double yimag = 0.0;
+
+    for (i=0; i<N; i++){
+        if (t[i] == RED){
+            xreal += cos(2*pi/L * x[2*i+0]);
+            ximag += sin(2*pi/L * x[2*i+0]);
+            yreal += cos(2*pi/L * x[2*i+1]);
+            yimag += sin(2*pi/L * x[2*i+1]);
+        }
+    }
+
+    *cmx = atan2(ximag,xreal)/(2*pi) * L;
+    *cmy = atan2(yimag,yreal)/(2*pi) * L;
+
+    if (*cmx < 0) *cmx += L;
+    if (*cmy < 0) *cmy += L;
+}
+
+
+double angularmom(double *x, double *v, int *t, int N, double L, int *pbc){
+    int i=0;
+    double ang = 0.0;
+    double cmx = 0.0;
+    double cmy = 0.0;
+    int count = 0;
+
+    centerofmass(x, t, N, L, &cmx, &cmy);
+
+    for (i=0; i<N; i++){
+        if (t[i] == RED){
+            double tx = x[2*i+0] - cmx;
+            double ty = x[2*i+1] - cmy;
+
+            if (pbc[0] && tx > L/2)  tx -= L;
+            if (pbc[1] && ty > L/2)  ty -= L;
+            if (pbc[0] && tx < -L/2) tx += L;
+            if (pbc[1] && ty < -L/2) ty += L;
+
+            double vx = v[2*i+0];
+            double vy = v[2*i+1];
+            double tv = vx*ty - vy*tx;
+            ang += tv;
+            count++;
+        }
+    }
+
+    return ang/count;
+}
+
+
+void temperature(double *x, double *v, int *t, int N, double L, int *pbc, int bins[RADS][BINS]){
+    int i=0;
+    double cmx = 0.0;
+    double cmy = 0.0;
+    int count = 0;
+
+    centerofmass(x, t, N, L, &cmx, &cmy);
+
+    for (i=0; i<N; i++){
+        if (t[i] == RED){
+            double dx = x[2*i+0] - cmx;
+            double dy = x[2*i+1] - cmy;
+            if (pbc[0] && dx > L/2)  dx -= L;
+            if (pbc[1] && dy > L/2)  dy -= L;
+            if (pbc[0] && dx < -L/2) dx += L;
+            if (pbc[1] && dy < -L/2) dy += L;
+
+            double rr = sqrt(dx*dx + dy*dy);
+            double vv = sqrt(v[2*i+0]*v[2*i+0] + v[2*i+1]*v[2*i+1]);
+
+            int rad = RADS * 2*rr/L;
+            int bin = BINS * vv/3;
+            if (rad < RADS && bin < BINS){
+                bins[rad][bin]++;
+            }
+            count++;
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef __ENTBODY_H__
+#define __ENTBODY_H__
+
+//===================================================
+// embeddable interface to the simulation.  the
+// simulation is an opaque handle; only the functions
+// and the two structs below are part of the ABI
+// (bump ENTBODY_ABI_VERSION when they change)
+//===================================================
+#define ENTBODY_ABI_VERSION 6
+
+#define BLACK   0
+#define RED     1
+#define RADS    10
+#define BINS    50
+
+typedef struct entbody entbody_t;
+
+// borrowed pointers into the live particle arrays,
+// valid until the next call that advances the state
+typedef struct {
+    long   N;
+    double L;
+    double t;
+    double dt;
+    long   step;
+    int    pbc[2];
+    double *x;          // [N][2]
+    double *v;          // [N][2]
+    double *rad;        // [N]
+    double *col;        // [N]
+    int    *type;       // [N]
+} entbody_view_t;
+
+typedef struct {
+    double t;
+    double angularmom;  // per RED particle, about the RED center of mass
+    double momentumx;   // mean RED velocity
+    double momentumy;
+    double cmx;         // periodic RED center of mass
+    double cmy;
+} entbody_obs_t;
+
+int  entbody_abi_version();
+
+entbody_t *entbody_create(long N, double alpha, double eta, int seed, double damp);
+void entbody_destroy(entbody_t *s);
+
+void entbody_step(entbody_t *s, long nsteps);
+void entbody_view(entbody_t *s, entbody_view_t *view);
+void entbody_observe(entbody_t *s, entbody_obs_t *obs);
+void entbody_temperature(entbody_t *s, int *bins);
+
+// coarse view for large N: RED and BLACK counts and the mean
+// velocity in each neighbor box (merged into at most 1024 a
+// side), out is [4][ny][nx] floats (or NULL to get the sizes).
+// returns the number of boxes
+int  entbody_density(entbody_t *s, int *nx, int *ny, float *out);
+
+// the neighbor boxes are a dense grid by default; the hashed grid
+// keeps only the occupied boxes so its memory and per step
+// clearing follow N instead of the area.  same trajectory
+void entbody_set_grid(entbody_t *s, int hashed);
+
+// rescale the box and positions to packing fraction phi (0.94 at
+// creation), returns 0 if phi is out of range or so dilute the
+// box would need more than 46340 neighbor boxes a side
+int  entbody_set_packing(entbody_t *s, double phi);
+
+// time trial steps over box sizes and thread counts and keep
+// the fastest; the choice is cached in the file (may be NULL)
+void entbody_autotune(entbody_t *s, const char *cache);
+
+// integrate each particle as soon as its force is known, reading
+// the old and writing the other of two position and velocity
+// buffers.  the trajectory is the same; only the x and v pointers
+// of the view change from step to step
+void entbody_set_fused(entbody_t *s, int fused);
+
+// interactive controls used by the viewer
+void entbody_hold(entbody_t *s, int hold);
+void entbody_set_speed(entbody_t *s, int type, double vhappy);
+void entbody_kick(entbody_t *s, double fx, double fy);
+
+// write the particles to a file, or replace them with those of a
+// file saved from a run with the same N.  loading restarts the
+// clock and re-keys the random stream from this instance's seed.
+// both return 0 on failure
+int  entbody_save(entbody_t *s, const char *filename);
+int  entbody_load(entbody_t *s, const char *filename);
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef __ENTBODY_INTERNAL_H__
+#define __ENTBODY_INTERNAL_H__
+
+//===================================================
+// the simulation state, shared between the modules
+// that are compiled together with entbody.c.  none of
+// this is visible through the public interface
+//===================================================
+#include "entbody.h"
+#include "numa.h"
+
+#define pi      3.141592653589
+
+struct entbody {
+    //-------------------------------------------
+    // parameters
+    long   N;
+    int    NMAX;
+    double radius;
+    double L;
+    int    pbc[2];
+
+    double epsilon;
+    double sigma;
+    double alpha;
+    double vhappy_black;
+    double vhappy_red;
+    double damp_coeff;
+
+    double dt;
+    double R, R2;
+    double FR, FR2;
+
+    //-------------------------------------------
+    // state
+    double t;
+    long   step;
+    int    hold;
+    int    fused;       // one pass per step into the x2/v2 buffers
+    unsigned long long vseed;
+    unsigned long long vran;
+
+    int    *type;
+    int    *neigh;      // two pass scratch, NULL in fused mode
+    double *rad;
+    double *col;
+    double *x;
+    double *v;
+    double *f;          // two pass scratch, NULL in fused mode
+    double *w;
+    double *o;
+    double *x2;         // next positions and velocities, fused mode only
+    double *v2;
+
+    //-------------------------------------------
+    // cell neighbor locator
+    int size[2];
+    int size_total;
+    int *count;
+    int *cells;
+    int *cellid;        // cell of each particle
+    int *hist;          // [hist_threads][size_total] for the parallel build
+    int hist_threads;
+
+    // sparse alternative: occupied boxes only, found by
+    // open addressing on the box index
+    int hashed;
+    long hcap;          // power of two, at least 2N
+    int *hkey;          // [hcap] box index, -1 if empty
+    int *hslot;         // [hcap] occupied box number
+    int *hstart;        // [N+1] members of each occupied box in hcells
+    int *hfill;         // [N]
+    int *hpart;         // [N] occupied box number of each particle
+    int *hcells;        // [N]
+
+    arena_t parena;     // particle arrays
+    arena_t carena;     // cell arrays
+    arena_t marena;     // scratch of the step mode in use
+};
+
+int    entbody_set_cells(entbody_t *s, int ncell);
+
+// the particles in box ind, for either grid
+static inline int cell_list(entbody_t *s, int ind, int **list){
+    if (!s->hashed){
+        *list = &s->cells[s->NMAX*ind];
+        return s->count[ind];
+    }
+    long h = ((unsigned int)ind * 2654435761u) & (s->hcap-1);
+    while (s->hkey[h] >= 0){
+        if (s->hkey[h] == ind){
+            int slot = s->hslot[h];
+            *list = &s->hcells[s->hstart[slot]];
+            return s->hstart[slot+1] - s->hstart[slot];
+        }
+        h = (h+1) & (s->hcap-1);
+    }
+    return 0;
+}
+
+void   ran_seed(entbody_t *s, long j);
+double ran_ran2(entbody_t *s);
+
+void   init_circle(entbody_t *s, double speed);
+void   init_random(entbody_t *s, double speed);
+
+// rebuild the boxes from the current positions; the step
+// bins before it moves the particles, so analyses that walk
+// the boxes after a step call this first
+void   entbody_bin(entbody_t *s);
+
+void   coords_to_index(double *x, int *size, int *index, double L);
+int    mod_rvec(int a, int b, int p, int *image);
+double mymod(double a, double b);
+
+void   centerofmass(double *x, int *t, int N, double L, double *cmx, double *cmy);
+double angularmom(double *x, double *v, int *t, int N, double L, int *pbc);
+void   temperature(double *x, double *v, int *t, int N, double L, int *pbc, int bins[RADS][BINS]);
+
+#endif
@@ -0,0 +1,157 @@
+//===================================================
+// Project: Collective motion at heavy metal concerts
+//===================================================
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+#include "equil.h"
+
+void equil_init(equil_t *eq){
+    int k;
+    eq->nsamp = 0;
+    for (k=0; k<EQUIL_NOBS; k++)
+        eq->cmean[k] = eq->cm2[k] = 0.0;
+
+    eq->nbatch   = 0;
+    eq->maxbatch = 1024;
+    eq->mean = (double*)malloc(sizeof(double)*EQUIL_NOBS*eq->maxbatch);
+    eq->m2   = (double*)malloc(sizeof(double)*EQUIL_NOBS*eq->maxbatch);
+}
+
+void equil_free(equil_t *eq){
+    free(eq->mean);
+    free(eq->m2);
+}
+
+void equil_add(equil_t *eq, double *obs){
+    int k;
+    eq->nsamp++;
+    for (k=0; k<EQUIL_NOBS; k++){
+        double delta = obs[k] - eq->cmean[k];
+        eq->cmean[k] += delta / eq->nsamp;
+        eq->cm2[k]   += delta * (obs[k] - eq->cmean[k]);
+    }
+
+    if (eq->nsamp < EQUIL_BATCH)
+        return;
+
+    if (eq->nbatch == eq->maxbatch){
+        eq->maxbatch *= 2;
+        eq->mean = (double*)realloc(eq->mean, sizeof(double)*EQUIL_NOBS*eq->maxbatch);
+        eq->m2   = (double*)realloc(eq->m2,   sizeof(double)*EQUIL_NOBS*eq->maxbatch);
+    }
+
+    for (k=0; k<EQUIL_NOBS; k++){
+        eq->mean[EQUIL_NOBS*eq->nbatch + k] = eq->cmean[k];
+        eq->m2[EQUIL_NOBS*eq->nbatch + k]   = eq->cm2[k];
+        eq->cmean[k] = eq->cm2[k] = 0.0;
+    }
+    eq->nbatch++;
+    eq->nsamp = 0;
+}
+
+//===================================================
+// MSER: the truncation d (in batches, d <= n/2) that
+// minimizes sum_{i>=d} (y_i - ybar_d)^2 / (n-d)^2.
+// we take the latest d over all monitored series
+//===================================================
+long equil_truncation(equil_t *eq, int *which, int nwhich){
+    long n = eq->nbatch;
+    long d, best = 0;
+    int w;
+
+    for (w=0; w<nwhich; w++){
+        int k = which[w];
+        double s1 = 0.0, s2 = 0.0;
+        double mser_min = DBL_MAX;
+        long dmin = 0;
+
+        // walk backwards accumulating suffix sums
+        for (d=n-1; d>=0; d--){
+            double y = eq->mean[EQUIL_NOBS*d + k];
+            s1 += y;
+            s2 += y*y;
+
+            if (d > n/2) continue;
+            long m = n - d;
+            double ss = s2 - s1*s1/m;
+            double mser = ss / ((double)m*m);
+            if (mser <= mser_min){
+                mser_min = mser;
+                dmin = d;
+            }
+        }
+        if (dmin > best) best = dmin;
+    }
+    return best;
+}
+
+//===================================================
+// merge the batches [trunc, nbatch) with Chan's rule
+// for the averages and variances, and estimate the
+// standard error of each average from sqrt(n) batch
+// means.  returns the number of samples retained
+//===================================================
+long equil_stats(equil_t *eq, long trunc, double *avg, double *std, double *sem){
+    long i, j;
+    int k;
+    long nb = eq->nbatch - trunc;
+
+    for (k=0; k<EQUIL_NOBS; k++){
+        double mean = 0.0, m2 = 0.0;
+        long count = 0;
+
+        for (i=trunc; i<eq->nbatch; i++){
+            double bmean = eq->mean[EQUIL_NOBS*i + k];
+            double bm2   = eq->m2[EQUIL_NOBS*i + k];
+            long   tot   = count + EQUIL_BATCH;
+            double delta = bmean - mean;
+
+            mean += delta * EQUIL_BATCH / tot;
+            m2   += bm2 + delta*delta * count * EQUIL_BATCH / tot;
+            count = tot;
+        }
+
+        avg[k] = mean;
+        std[k] = count > 1 ? sqrt(m2 / (count - 1)) : 0.0;
+
+        // macro batches built from the most recent batches
+        long nmacro = (long)sqrt((double)nb);
+        sem[k] = DBL_MAX;
+        if (nmacro < 2) continue;
+
+        long msize = nb / nmacro;
+        long first = eq->nbatch - nmacro*msize;
+        double mmean = 0.0, mm2 = 0.0;
+        for (i=0; i<nmacro; i++){
+            double y = 0.0;
+            for (j=0; j<msize; j++)
+                y += eq->mean[EQUIL_NOBS*(first + i*msize + j) + k];
+            y /= msize;
+
+            double delta = y - mmean;
+            mmean += delta / (i+1);
+            mm2   += delta * (y - mmean);
+        }
+        sem[k] = sqrt(mm2 / (nmacro - 1) / nmacro);
+    }
+    return nb * EQUIL_BATCH;
+}
+
+int equil_converged(equil_t *eq, int *which, int nwhich, double tol){
+    double avg[EQUIL_NOBS], std[EQUIL_NOBS], sem[EQUIL_NOBS];
+    int w;
+
+    // a truncation at (or near) its n/2 bound means MSER
+    // found no minimum inside the window: still drifting
+    long trunc = equil_truncation(eq, which, nwhich);
+    if (eq->nbatch - trunc < EQUIL_MINBATCH ||
+        2*(trunc + EQUIL_MARGIN) >= eq->nbatch)
+        return 0;
+
+    equil_stats(eq, trunc, avg, std, sem);
+    for (w=0; w<nwhich; w++)
+        if (!(sem[which[w]] < tol))
+            return 0;
+    return 1;
+}
@@ -0,0 +1,37 @@
+#ifndef __EQUIL_H__
+#define __EQUIL_H__
+
+//===================================================
+// steady state detection for the measured series
+//  - samples are grouped into batches of EQUIL_BATCH
+//    steps, each kept as a (mean, M2) Welford pair
+//  - the transient is found with MSER on the batch
+//    means of the monitored observables
+//  - standard errors come from batch means over the
+//    retained part of the series
+//===================================================
+#define EQUIL_NOBS     6
+#define EQUIL_BATCH    10
+#define EQUIL_MINBATCH 40
+#define EQUIL_MARGIN   5     // batches a truncation must clear n/2 by
+
+typedef struct {
+    long   nsamp;           // samples in the current batch
+    double cmean[EQUIL_NOBS];
+    double cm2[EQUIL_NOBS];
+
+    long   nbatch;          // completed batches
+    long   maxbatch;
+    double *mean;           // [nbatch][EQUIL_NOBS]
+    double *m2;
+} equil_t;
+
+void equil_init(equil_t *eq);
+void equil_free(equil_t *eq);
+void equil_add(equil_t *eq, double *obs);
+
+long equil_truncation(equil_t *eq, int *which, int nwhich);
+long equil_stats(equil_t *eq, long trunc, double *avg, double *std, double *sem);
+int  equil_converged(equil_t *eq, int *which, int nwhich, double tol);
+
+#endif
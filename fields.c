@@ -0,0 +1,144 @@
+//===================================================
+// Project: Collective motion at heavy metal concerts
+//===================================================
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "entbody_internal.h"
+#include "fields.h"
+
+void fields_init(fields_t *f, entbody_t *s){
+    int n = s->size_total;
+    f->nx = s->size[0];
+    f->ny = s->size[1];
+    f->L  = s->L;
+    f->nsamp = 0;
+
+    f->nred   = (double*)calloc(n, sizeof(double));
+    f->nblack = (double*)calloc(n, sizeof(double));
+    f->vx     = (double*)calloc(n, sizeof(double));
+    f->vy     = (double*)calloc(n, sizeof(double));
+    f->ux     = (double*)calloc(n, sizeof(double));
+    f->uy     = (double*)calloc(n, sizeof(double));
+    f->out    = (float*)calloc(FIELD_NUM*n, sizeof(float));
+}
+
+void fields_free(fields_t *f){
+    free(f->nred);
+    free(f->nblack);
+    free(f->vx);
+    free(f->vy);
+    free(f->ux);
+    free(f->uy);
+    free(f->out);
+}
+
+//===================================================
+// add the current state, binned afresh since the
+// boxes of the last step predate its moves.  every
+// box is shifted by a whole number of boxes so the
+// center of mass sits in the middle box, and boxes
+// map one to one, so they can be done in parallel
+// without conflicts
+//===================================================
+void fields_accumulate(fields_t *f, entbody_t *s, double cmx, double cmy){
+    int nx = f->nx, ny = f->ny;
+    int c;
+
+    entbody_bin(s);
+    int shx = (int)floor((s->L/2 - cmx) / s->L * nx + 0.5);
+    int shy = (int)floor((s->L/2 - cmy) / s->L * ny + 0.5);
+
+    #ifdef OPENMP
+    #pragma omp parallel for schedule(static)
+    #endif
+    for (c=0; c<nx*ny; c++){
+        int cx = c % nx;
+        int cy = c / nx;
+        int tx = ((cx + shx) % nx + nx) % nx;
+        int ty = ((cy + shy) % ny + ny) % ny;
+        int t  = tx + ty*nx;
+        int j;
+
+        int *list;
+        int nlist = cell_list(s, c, &list);
+        for (j=0; j<nlist; j++){
+            int i = list[j];
+            double vx = s->v[2*i+0];
+            double vy = s->v[2*i+1];
+
+            f->vx[t] += vx;
+            f->vy[t] += vy;
+            if (s->type[i] == RED){
+                double vlen = sqrt(vx*vx + vy*vy);
+                f->nred[t] += 1;
+                if (vlen > 1e-6){
+                    f->ux[t] += vx / vlen;
+                    f->uy[t] += vy / vlen;
+                }
+            }
+            else
+                f->nblack[t] += 1;
+        }
+    }
+    f->nsamp++;
+}
+
+//===================================================
+// turn the sums into averages, take the vorticity of
+// the mean velocity with central differences, write
+// the snapshot and start a new average
+//===================================================
+void fields_write(fields_t *f, FILE *file, double t){
+    int nx = f->nx, ny = f->ny, n = nx*ny;
+    int c;
+    double area = (f->L/nx) * (f->L/ny);
+    double hx = f->L/nx, hy = f->L/ny;
+
+    float *rr = &f->out[0*n];
+    float *rb = &f->out[1*n];
+    float *vx = &f->out[2*n];
+    float *vy = &f->out[3*n];
+    float *px = &f->out[4*n];
+    float *py = &f->out[5*n];
+    float *wz = &f->out[6*n];
+
+    #ifdef OPENMP
+    #pragma omp parallel for schedule(static)
+    #endif
+    for (c=0; c<n; c++){
+        double ntot = f->nred[c] + f->nblack[c];
+        double ns = f->nsamp > 0 ? f->nsamp : 1;
+        rr[c] = f->nred[c]   / (area*ns);
+        rb[c] = f->nblack[c] / (area*ns);
+        vx[c] = ntot > 0 ? f->vx[c] / ntot : 0.0;
+        vy[c] = ntot > 0 ? f->vy[c] / ntot : 0.0;
+        px[c] = f->nred[c] > 0 ? f->ux[c] / f->nred[c] : 0.0;
+        py[c] = f->nred[c] > 0 ? f->uy[c] / f->nred[c] : 0.0;
+    }
+
+    #ifdef OPENMP
+    #pragma omp parallel for schedule(static)
+    #endif
+    for (c=0; c<n; c++){
+        int cx = c % nx, cy = c / nx;
+        int xp = (cx+1) % nx + cy*nx, xm = (cx-1+nx) % nx + cy*nx;
+        int yp = cx + ((cy+1) % ny)*nx, ym = cx + ((cy-1+ny) % ny)*nx;
+        wz[c] = (vy[xp] - vy[xm]) / (2*hx) - (vx[yp] - vx[ym]) / (2*hy);
+    }
+
+    fwrite(&f->nx, sizeof(int), 1, file);
+    fwrite(&f->ny, sizeof(int), 1, file);
+    fwrite(&f->L, sizeof(double), 1, file);
+    fwrite(&t, sizeof(double), 1, file);
+    fwrite(&f->nsamp, sizeof(long), 1, file);
+    fwrite(f->out, sizeof(float), FIELD_NUM*n, file);
+
+    memset(f->nred,   0, sizeof(double)*n);
+    memset(f->nblack, 0, sizeof(double)*n);
+    memset(f->vx, 0, sizeof(double)*n);
+    memset(f->vy, 0, sizeof(double)*n);
+    memset(f->ux, 0, sizeof(double)*n);
+    memset(f->uy, 0, sizeof(double)*n);
+    f->nsamp = 0;
+}
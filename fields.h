@@ -0,0 +1,37 @@
+#ifndef __FIELDS_H__
+#define __FIELDS_H__
+
+#include <stdio.h>
+#include "entbody.h"
+
+//===================================================
+// coarse grained fields on the boxes of the neighbor
+// locator, averaged in the frame of the RED center
+// of mass.  each snapshot is the average since the
+// last one and is written in binary as
+//   int nx, ny; double L, t; long samples;
+//   float rho_red[ny][nx], rho_black[ny][nx],
+//         vx[ny][nx], vy[ny][nx],
+//         px[ny][nx], py[ny][nx], vort[ny][nx]
+// where p is the RED polarisation (mean heading)
+//===================================================
+#define FIELD_NUM 7
+
+typedef struct {
+    int    nx, ny;
+    double L;
+    long   nsamp;
+
+    double *nred;       // [ny*nx] summed over samples
+    double *nblack;
+    double *vx, *vy;    // velocity sums, all particles
+    double *ux, *uy;    // unit heading sums, RED particles
+    float  *out;        // [FIELD_NUM][ny*nx]
+} fields_t;
+
+void fields_init(fields_t *f, entbody_t *s);
+void fields_free(fields_t *f);
+void fields_accumulate(fields_t *f, entbody_t *s, double cmx, double cmy);
+void fields_write(fields_t *f, FILE *file, double t);
+
+#endif
@@ -5,7 +5,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
-#include <float.h>
+#include <unistd.h>
+#include "entbody.h"
+#include "equil.h"
+#include "numa.h"
+#include "correlator.h"
+#include "fields.h"
+#include "cluster.h"
+#include "traj.h"
 
 #ifdef PLOT
 #include "plot.h"
@@ -20,36 +27,51 @@
 //#define ANGULARMOM_TIMESERIES
 //#define VELOCITY_DISTRIBUTION
 //#define TEMPERATURE_BINS
+//#define CORRELATORS
+//#define FIELD_SNAPSHOTS
+#define FIELD_STRIDE        100
+//#define CLUSTER_ANALYSIS
+#define CLUSTER_STRIDE      10
+#define TRAJ_STRIDE         10
 #define SHOWCENTEROFMASS    0
 #define SHOWVELOCITYARROWS  1
 #define SHOWFORCECOLORS     0
 //===========================================
 
-//-----------------------------------------------------------
-// some defines and helper functions for NBL
-//------------------------------------------------------------
-#define pi      3.141592653589
-#define EPSILON DBL_EPSILON
-#define BLACK   0
-#define RED     1
-#define RADS    10
-#define BINS    50
-
-void simulate(double alpha, double sigma, int seed, double damp);
-
-void   init_circle(double *x, double *v, int *t, double s, long N, double L);
-void   temperature(double *x, double *v, int *t, int N, double L, int *pbc, int bins[RADS][BINS]);
-void   centerofmass(double *x, int *t, int N, double L, double *cmx, double *cmy);
-double angularmom(double *x, double *v, int *t, int N, double L, int *pbc);
-
-void   coords_to_index(double *x, int *size, int *index, double L);
-int    mod_rvec(int a, int b, int p, int *image);
-double mymod(double a, double b);
+//===========================================
+// run options set from the command line
+typedef struct {
+    long   N;           // number of particles
+    double tol;         // stop once the standard errors are below this
+    double tmax;        // maximum simulation time, 0 for the default
+    int    pin;         // thread affinity, PIN_*
+    char  *tune;        // autotuning cache file, NULL to skip tuning
+    char  *input;       // state to continue from, NULL for a cold start
+    char  *output;      // file for the final state, NULL to skip
+    int    fused;       // single pass force and integration
+    int    hashed;      // hashed instead of dense neighbor boxes
+    double phi;         // packing fraction, 0 for the default
+    char  *record;      // trajectory file for ./replay, NULL to skip
+} options_t;
+
+void simulate(double alpha, double sigma, int seed, double damp, options_t *opts);
 
-void   ran_seed(long j);
-double ran_ran2();
-unsigned long long int vseed;
-unsigned long long int vran;
+#ifdef PLOT
+//===================================================
+// draw the particles, or the density of the boxes
+// when they would be too small or too many to see
+//===================================================
+int *render_frame(entbody_t *sim, entbody_view_t *view, float *dens, int forces,
+                  double cmx, double cmy, int docom){
+    int nx, ny;
+    if (plot_use_density(view->N, view->L, view->rad[0])){
+        entbody_density(sim, &nx, &ny, dens);
+        return plot_render_density(dens, nx, ny, view->L, view->rad[0], forces, SHOWVELOCITYARROWS);
+    }
+    return plot_render_particles(view->x, view->rad, view->type, view->N, view->L, view->col,
+            forces, cmx, cmy, docom, view->pbc, view->v, SHOWVELOCITYARROWS);
+}
+#endif
 
 
 //===================================================
@@ -61,18 +83,60 @@ int main(int argc, char **argv){
     double damp_in  = 1.0;
     int seed_in     = 0;
 
-    if (argc == 1) 
-        simulate(alpha_in, sigma_in, seed_in, damp_in);
-    else if (argc == 5){
-        alpha_in = atof(argv[1]);
-        sigma_in = atof(argv[2]);
-        seed_in  = atoi(argv[3]);
-        damp_in  = atof(argv[4]);
-        simulate(alpha_in, sigma_in, seed_in, damp_in);
+    options_t opts;
+    opts.N    = 1000;
+    opts.tol  = 0.0;
+    opts.tmax = 0.0;
+    opts.pin  = PIN_NONE;
+    opts.tune = NULL;
+    opts.input  = NULL;
+    opts.output = NULL;
+    opts.fused  = 0;
+    opts.hashed = 0;
+    opts.phi    = 0.0;
+    opts.record = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "e:T:N:a:A:i:o:FHp:r:")) != -1){
+        switch (opt){
+            case 'e': opts.tol  = atof(optarg); break;
+            case 'T': opts.tmax = atof(optarg); break;
+            case 'N': opts.N    = atol(optarg); break;
+            case 'a': if ((opts.pin = pin_mode(optarg)) < 0) argc = -1; break;
+            case 'A': opts.tune = optarg; break;
+            case 'i': opts.input  = optarg; break;
+            case 'o': opts.output = optarg; break;
+            case 'F': opts.fused  = 1; break;
+            case 'H': opts.hashed = 1; break;
+            case 'p': opts.phi    = atof(optarg); break;
+            case 'r': opts.record = optarg; break;
+            default:  argc = -1;
+        }
+    }
+
+    if (argc == optind) 
+        simulate(alpha_in, sigma_in, seed_in, damp_in, &opts);
+    else if (argc - optind == 4){
+        alpha_in = atof(argv[optind+0]);
+        sigma_in = atof(argv[optind+1]);
+        seed_in  = atoi(argv[optind+2]);
+        damp_in  = atof(argv[optind+3]);
+        simulate(alpha_in, sigma_in, seed_in, damp_in, &opts);
     }
     else {
         printf("usage:\n");
-        printf("\t./entbody [alpha] [eta] [seed]\n");
+        printf("\t./entbody [-e tol] [-T tmax] [-N particles] [-a compact|scatter] [-A cache] [-i state] [-o state] [-F] [-H] [-p phi] [-r trajectory] [alpha] [eta] [seed] [damp]\n");
+        printf("\t  -e  stop once the standard errors of <L>, <px>, <py> are below tol\n");
+        printf("\t  -T  maximum simulation time (default 1e3)\n");
+        printf("\t  -N  number of particles (default 1000)\n");
+        printf("\t  -a  pin the OpenMP threads socket by socket or round robin over sockets\n");
+        printf("\t  -A  autotune box size and threads at startup, caching the choice in this file\n");
+        printf("\t  -i  start from a state saved by -o (same N) instead of the initial circle\n");
+        printf("\t  -o  save the final state to this file\n");
+        printf("\t  -H  use the hashed grid of occupied neighbor boxes instead of the dense one\n");
+        printf("\t  -p  packing fraction of the box (default 0.94)\n");
+        printf("\t  -F  fuse the force and integration passes (same trajectory, less memory traffic)\n");
+        printf("\t  -r  record every %i steps to this file for ./replay\n", TRAJ_STRIDE);
     }
     return 0;
 }
@@ -82,52 +146,39 @@ int main(int argc, char **argv){
 //==================================================
 // simulation
 //==================================================
-void simulate(double alphain, double sigmain, int seed, double dampin){
-    ran_seed(seed);
-    int  RIC  = 0;
-
-    int    NMAX    = 50;
-    int    N       = 1000;
-    double radius  = 1.0;
-    double L       = 1.03*sqrt(pi*radius*radius*N);
-
-    int pbc[] = {1,1};
-
-    double epsilon = 25.0;
-    double sigma   = sigmain;
-    double alpha   = alphain;
-
-    double vhappy_black = 0.0;
-    double vhappy_red   = 1.0;
-    double damp_coeff   = dampin;
-
-    double dt  = 1e-1;
-    double t   = 0.0;
-    double R   = 2*radius; 
-    double R2  = R*R;
-    double FR  = 2*R;
-    double FR2 = FR*FR;
-
-    int i, j, k;
-
-    int *type   = (int*)malloc(sizeof(int)*N);
-    int *neigh  = (int*)malloc(sizeof(int)*N);
-    double *rad = (double*)malloc(sizeof(double)*N); 
-    double *col = (double*)malloc(sizeof(double)*N); 
-    for (i=0; i<N; i++){ type[i] = neigh[i] = rad[i] = 0;}
-
-    double *x = (double*)malloc(sizeof(double)*2*N);
-    double *v = (double*)malloc(sizeof(double)*2*N);
-    double *f = (double*)malloc(sizeof(double)*2*N);
-    double *w = (double*)malloc(sizeof(double)*2*N);
-    double *o = (double*)malloc(sizeof(double)*2*N);
-    for (i=0; i<2*N; i++){o[i] = x[i] = v[i] = f[i] = w[i] = 0.0;}
+void simulate(double alphain, double sigmain, int seed, double dampin, options_t *opts){
+    long N = opts->N;
+    double tol = opts->tol;
+    int i, k;
+
+    // pin before the arrays are allocated so first touch
+    // lands on the socket of the owning thread
+    if (opts->pin != PIN_NONE){
+        int npinned = pin_threads(opts->pin);
+        fprintf(stderr, "pinned %i threads\n", npinned);
+    }
+
+    entbody_t *sim = entbody_create(N, alphain, sigmain, seed, dampin);
+    if (opts->hashed)
+        entbody_set_grid(sim, 1);
+    if (opts->phi > 0 && !entbody_set_packing(sim, opts->phi))
+        fprintf(stderr, "packing fraction %f out of range, keeping the default\n", opts->phi);
+    if (opts->input && !entbody_load(sim, opts->input))
+        fprintf(stderr, "could not continue from %s, starting cold\n", opts->input);
+    entbody_set_fused(sim, opts->fused);
+    if (opts->tune)
+        entbody_autotune(sim, opts->tune);
+    entbody_view_t view;
+    entbody_obs_t obs;
+    entbody_view(sim, &view);
 
     #ifdef PLOT 
     double time_end = 1e20;
     #else
     double time_end = 1e3;
     #endif
+    if (opts->tmax > 0)
+        time_end = opts->tmax;
 
     #ifdef PLOT 
         int *key;
@@ -136,55 +187,13 @@ void simulate(double alphain, double sigmain, int seed, double dampin){
         #ifdef OPENIL
             plot_initialize_canvas();
         #endif
+        int dnx, dny;
+        float *dens = (float*)malloc(sizeof(float)*4*entbody_density(sim, &dnx, &dny, NULL));
         plot_clear_screen();
-        key = plot_render_particles(x, rad, type, N, L,col,0,0,0,0, pbc,v, SHOWVELOCITYARROWS);
+        key = render_frame(sim, &view, dens, 0, 0, 0, 0);
         int showplot = 1;
     #endif
 
-    //-------------------------------------------------
-    // initialize
-    if (RIC){
-        for (i=0; i<N; i++){
-            double t = 2*pi*ran_ran2();
-    
-            rad[i] = radius;
-            x[2*i+0] = L*ran_ran2();
-            x[2*i+1] = L*ran_ran2();
-     
-            if (ran_ran2() > 0.16){
-                v[2*i+0] = 0.0;
-                v[2*i+1] = 0.0;
-                type[i] = BLACK;
-            }
-            else {
-                v[2*i+0] = vhappy_red * sin(t);
-                v[2*i+1] = vhappy_red * cos(t);
-                type[i] = RED;
-            } 
-        }
-    }
-    else {
-        for (i=0; i<N; i++)
-            rad[i] = radius;
-        init_circle(x, v, type, vhappy_red, N, L);
-    }
-
-    //-------------------------------------------------------
-    // make boxes for the neighborlist
-    int size[2];
-    int size_total = 1;
-    for (i=0; i<2; i++){
-        size[i] = (int)(L / (FR)); 
-        size_total *= size[i];
-    }
-
-    int *count = (int*)malloc(sizeof(int)*size_total);
-    int *cells = (int*)malloc(sizeof(int)*size_total*NMAX);
-    for (i=0; i<size_total; i++)
-        count[i] = 0;
-    for (i=0; i<size_total*NMAX; i++)
-        cells[i] = 0;
-
     //==========================================================
     // where the magic happens
     //==========================================================
@@ -195,22 +204,10 @@ void simulate(double alphain, double sigmain, int seed, double dampin){
     clock_gettime(CLOCK_REALTIME, &start);
     #endif
 
-    double angularmom_avg    = 0.0;
-    double angularmom_std    = 0.0;
-    double angularmom_sq_avg = 0.0;
-    double angularmom_sq_std = 0.0;
-    int angularmom_count = 0;
-
-    double momentumx_avg = 0.0;
-    double momentumx_std = 0.0;
-    double momentumy_avg = 0.0;
-    double momentumy_std = 0.0;
-    int momentum_count = 0;
-    
-    double momentumsqx_avg = 0.0;
-    double momentumsqx_std = 0.0;
-    double momentumsqy_avg = 0.0;
-    double momentumsqy_std = 0.0;
+    // the series monitored for the transient: L, px, py
+    int monitored[] = {0, 2, 3};
+    equil_t eq;
+    equil_init(&eq);
 
     #ifdef ANGULARMOM_TIMESERIES
     FILE *file1 = fopen("angularmom.txt", "wb");
@@ -220,10 +217,46 @@ void simulate(double alphain, double sigmain, int seed, double dampin){
     FILE *file2 = fopen("velocities.txt", "wb");
     #endif
 
+    #ifdef CORRELATORS
+    // angular momentum, RED velocity and unwrapped position
+    correlator_t corr_ang, corr_vel, corr_msd;
+    double corr_angavg = 0.0;
+    int nred = 0;
+    for (i=0; i<N; i++)
+        if (view.type[i] == RED) nred++;
+
+    double *vred  = (double*)malloc(sizeof(double)*2*nred);
+    double *xu    = (double*)malloc(sizeof(double)*2*N);
+    double *xprev = (double*)malloc(sizeof(double)*2*N);
+    for (i=0; i<2*N; i++)
+        xu[i] = xprev[i] = view.x[i];
+
+    corr_init(&corr_ang, CORR_PRODUCT, 1, 1);
+    corr_init(&corr_vel, CORR_PRODUCT, 2*nred, 2);
+    corr_init(&corr_msd, CORR_SQDIST, 2*N, 2);
+    #endif
+
+    #ifdef FIELD_SNAPSHOTS
+    fields_t fields;
+    fields_init(&fields, sim);
+    FILE *file4 = fopen("fields.bin", "wb");
+    #endif
+
+    FILE *ftraj = NULL;
+    if (opts->record && !(ftraj = traj_create(opts->record, &view, TRAJ_STRIDE)))
+        fprintf(stderr, "could not record to %s\n", opts->record);
+
+    #ifdef CLUSTER_ANALYSIS
+    cluster_t clusters;
+    cluster_init(&clusters, N);
+    FILE *file5 = fopen("clusters.txt", "w");
+    #endif
+
     #ifdef TEMPERATURE_BINS 
     int bins[RADS][BINS];
+    int j;
     char name[80];
-    sprintf(name, "temp_%0.2f.txt", damp_coeff);
+    sprintf(name, "temp_%0.2f.txt", dampin);
     FILE *file3 = fopen(name, "w");
     for (i=0; i<RADS; i++){
         for (j=0; j<BINS; j++){
@@ -232,179 +265,30 @@ void simulate(double alphain, double sigmain, int seed, double dampin){
     }
     #endif
 
-    for (t=0.0; t<time_end; t+=dt){
-
-        int index[2];
-        for (i=0; i<size_total; i++)
-            count[i] = 0;
-
-        for (i=0; i<N; i++){
-            coords_to_index(&x[2*i], size, index, L);
-            int t = index[0] + index[1]*size[0];
-            cells[NMAX*t + count[t]] = i;
-            count[t]++; 
-        }
-
-        int tt[2];
-        int tix[2];
-        int image[2];
-        double dx[2];
-        int goodcell, ind, n;
-        double r0, l, co, co1, dist;
-        double wlen, vlen, vhappy;
-
-        #ifdef OPENMP
-        #pragma omp parallel for private(i,dx,index,tt,goodcell,tix,ind,j,n,image,k,dist,r0,l,co,wlen,vlen,vhappy)
-        #endif 
-        for (i=0; i<N; i++){
-            f[2*i+0] = 0.0;
-            f[2*i+1] = 0.0;
-            w[2*i+0] = 0.0;
-            w[2*i+1] = 0.0;
-            neigh[i] = 0;
-            
-            coords_to_index(&x[2*i], size, index, L);
-
-            for (tt[0]=-1; tt[0]<=1; tt[0]++){
-            for (tt[1]=-1; tt[1]<=1; tt[1]++){
-                goodcell = 1;    
-                for (j=0; j<2; j++){
-                    tix[j] = mod_rvec(index[j]+tt[j],size[j]-1,pbc[j],&image[j]);
-                    if (pbc[j] < image[j])
-                        goodcell=0;
-                }
-
-                if (goodcell){
-                    ind = tix[0] + tix[1]*size[0]; 
-
-                    for (j=0; j<count[ind]; j++){
-                        n = cells[NMAX*ind+j];
-
-                        dist = 0.0;
-                        for (k=0; k<2; k++){
-                            dx[k] = x[2*n+k] - x[2*i+k];
-                    
-                            if (image[k])
-                                dx[k] += L*tt[k];
-                            dist += dx[k]*dx[k];
-                        }
-
-                        //===============================================
-                        // force calculation - hertz
-                        if (dist > 1e-10 && dist < R2){
-                            r0 = R; 
-                            l  = sqrt(dist);
-                            co1 = (1-l/r0);
-                            co = epsilon * co1*sqrt(co1) * (l<r0);
-                            for (k=0; k<2; k++){
-                                f[2*i+k] += - dx[k]/l * co;
-                                col[i] += co*co*dx[k]*dx[k]/dist; 
-                            }
-                        }
-                        //===============================================
-                        // add up the neighbor veocities
-                        if (dist > 1e-10 && dist < FR2 && type[n] == RED && type[i] == RED){
-                             for (k=0; k<2; k++)
-                                w[2*i+k] += v[2*n+k];
-                            neigh[i]++;
-                        }                           
-                    }
-                }
-            } } 
-
-            //=====================================
-            // flocking force 
-            wlen = sqrt(w[2*i+0]*w[2*i+0] + w[2*i+1]*w[2*i+1]);
-            if (type[i] == RED && neigh[i] > 0 && wlen > 1e-6){
-                f[2*i+0] += alpha * w[2*i+0] / wlen; 
-                f[2*i+1] += alpha * w[2*i+1] / wlen;
-            }
-
-            //====================================
-            // self-propulsion
-            vlen = sqrt(v[2*i+0]*v[2*i+0] + v[2*i+1]*v[2*i+1]);
-            vhappy = type[i]==RED?vhappy_red:vhappy_black;
-            if (vlen > 1e-6){
-                f[2*i+0] += damp_coeff*(vhappy - vlen)*v[2*i+0]/vlen;
-                f[2*i+1] += damp_coeff*(vhappy - vlen)*v[2*i+1]/vlen;
-            }
-        
-            //=======================================
-            // noise term
-            if (type[i] == RED){
-                // Box-Muller method
-                double u1 = ran_ran2();
-                double u2 = 2*pi*ran_ran2();
-                double lfac = sqrt(-2*log(u1));
-                f[2*i+0] += sigma*lfac*cos(u2);
-                f[2*i+1] += sigma*lfac*sin(u2);
-            }
-
-            //=====================================
-            // kick force
-            f[2*i+0] += o[2*i+0]; o[2*i+0] = 0.0;
-            f[2*i+1] += o[2*i+1]; o[2*i+1] = 0.0;
-        }
-        #ifdef OPENMP
-        #pragma omp barrier
+    double t = 0.0;
+    while (t < time_end){
+        #ifdef PLOT
+        entbody_hold(sim, key['h'] == 1);
         #endif
+        entbody_step(sim, 1);
+        entbody_view(sim, &view);
+        entbody_observe(sim, &obs);
+        t = obs.t;
 
-        // now integrate the forces since we have found them
-        #ifdef OPENMP
-        #pragma omp parallel for private(j)
-        #endif 
-        for (i=0; i<N;i++){
-            // Newton-Stomer-Verlet
-            #ifdef PLOT
-            if (key['h'] != 1){
-            #endif
-            v[2*i+0] += f[2*i+0] * dt;
-            v[2*i+1] += f[2*i+1] * dt;
-
-            x[2*i+0] += v[2*i+0] * dt;
-            x[2*i+1] += v[2*i+1] * dt;
-            #ifdef PLOT
-            }   
-            #endif
-
-            #ifdef VELOCITY_DISTRIBUTION
+        #ifdef VELOCITY_DISTRIBUTION
+        for (i=0; i<N; i++){
+            double *v  = view.v;
             double ttt = sqrt(v[2*i+0]*v[2*i+0] + v[2*i+1]*v[2*i+1]) ;
             fwrite(&ttt, sizeof(double), 1, file2);
-            #endif
-
-            // boundary conditions 
-            for (j=0; j<2; j++){
-                if (pbc[j] == 1){
-                    if (x[2*i+j] >= L-EPSILON || x[2*i+j] < 0)
-                        x[2*i+j] = mymod(x[2*i+j], L);
-                }
-                else {
-                    const double restoration = 1.0;
-                    if (x[2*i+j] >= L){x[2*i+j] = 2*L-x[2*i+j]; v[2*i+j] *= -restoration;}
-                    if (x[2*i+j] < 0) {x[2*i+j] = -x[2*i+j];    v[2*i+j] *= -restoration;}
-                    if (x[2*i+j] >= L-EPSILON || x[2*i+j] < 0){x[2*i+j] = mymod(x[2*i+j], L);}
-                }
-            }
-
-            // just check for errors
-            if (x[2*i+0] >= L || x[2*i+0] < 0.0 ||
-                x[2*i+1] >= L || x[2*i+1] < 0.0)
-                printf("out of bounds\n");
-            
-            col[i] = col[i]/12; 
         }
-        #ifdef OPENMP
-        #pragma omp barrier
         #endif
 
         #ifdef PLOT 
-        int skip = 10; if (RIC == 1) skip *=3;
+        int skip = 10;
         int start = 20;
         if (frames % skip == 0 && frames >= start){
-            double cmx, cmy;
-            centerofmass(x, type, N, L, &cmx, &cmy);
             plot_clear_screen();
-            key = plot_render_particles(x, rad, type, N, L,col, SHOWFORCECOLORS, cmx, cmy, SHOWCENTEROFMASS, pbc, v, SHOWVELOCITYARROWS);
+            key = render_frame(sim, &view, dens, SHOWFORCECOLORS, obs.cmx, obs.cmy, SHOWCENTEROFMASS);
            
             #ifdef OPENIL
                 char fname[100];
@@ -415,57 +299,58 @@ void simulate(double alphain, double sigmain, int seed, double dampin){
         #endif
         frames++;
 
-        angularmom_count++;
-        
-        double vtemp     = angularmom(x,v,type,N,L,pbc);
-        double delta     = vtemp    - angularmom_avg;
-        angularmom_avg    = angularmom_avg    + delta    / angularmom_count; 
-        angularmom_std    = angularmom_std    + delta    * (vtemp    - angularmom_avg);
-        
-        double vtemp_sq  = vtemp*vtemp;
-        double delta_sq  = vtemp_sq - angularmom_sq_avg;
-        angularmom_sq_avg = angularmom_sq_avg + delta_sq / angularmom_count;
-        angularmom_sq_std = angularmom_sq_std + delta_sq * (vtemp_sq - angularmom_sq_avg);
-
-
-        double linearmomx = 0.0;
-        double linearmomy = 0.0;
-        int linearmomc = 0;
-        for (i=0; i<N; i++){
-            if (type[i] == RED){
-                linearmomx += v[2*i+0];
-                linearmomy += v[2*i+1];
-                linearmomc++;
-            }
-        }
-        linearmomx /= linearmomc;
-        linearmomy /= linearmomc;
-        momentum_count++;
-
-        double deltax = linearmomx - momentumx_avg;
-        double deltay = linearmomy - momentumy_avg;
-        momentumx_avg = momentumx_avg + deltax / momentum_count;
-        momentumy_avg = momentumy_avg + deltay / momentum_count;
-        momentumx_std = momentumx_std + deltax * (linearmomx - momentumx_avg);
-        momentumy_std = momentumy_std + deltay * (linearmomy - momentumy_avg);
-
-        double linearmomsqx = linearmomx*linearmomx;
-        double linearmomsqy = linearmomy*linearmomy;
-        double deltasqx = linearmomsqx - momentumsqx_avg;
-        double deltasqy = linearmomsqy - momentumsqy_avg;
-        momentumsqx_avg = momentumsqx_avg + deltasqx / momentum_count;
-        momentumsqy_avg = momentumsqy_avg + deltasqy / momentum_count;
-        momentumsqx_std = momentumsqx_std + deltasqx * (linearmomsqx - momentumsqx_avg);
-        momentumsqy_std = momentumsqy_std + deltasqy * (linearmomsqy - momentumsqy_avg);
+        double vtemp      = obs.angularmom;
+        double linearmomx = obs.momentumx;
+        double linearmomy = obs.momentumy;
+
+        double obsv[EQUIL_NOBS] = {vtemp, vtemp*vtemp, linearmomx, linearmomy,
+                                   linearmomx*linearmomx, linearmomy*linearmomy};
+        equil_add(&eq, obsv);
+
+        if (tol > 0 && eq.nsamp == 0 && eq.nbatch % 10 == 0 &&
+            equil_converged(&eq, monitored, 3, tol))
+            break;
 
         #ifdef TEMPERATURE_BINS
-        temperature(x, v, type, N, L, pbc, bins);
+        entbody_temperature(sim, &bins[0][0]);
         #endif
 
         #ifdef ANGULARMOM_TIMESERIES
         fwrite(&vtemp, sizeof(double), 1, file1);
         #endif
 
+        #ifdef FIELD_SNAPSHOTS
+        fields_accumulate(&fields, sim, obs.cmx, obs.cmy);
+        if (frames % FIELD_STRIDE == 0)
+            fields_write(&fields, file4, t);
+        #endif
+
+        if (ftraj && frames % TRAJ_STRIDE == 0)
+            traj_append(ftraj, &view);
+
+        #ifdef CLUSTER_ANALYSIS
+        if (frames % CLUSTER_STRIDE == 0){
+            cluster_find(&clusters, sim);
+            cluster_write(&clusters, sim, file5);
+        }
+        #endif
+
+        #ifdef CORRELATORS
+        corr_add(&corr_ang, &vtemp);
+        corr_angavg += (vtemp - corr_angavg) / frames;
+
+        for (i=0, k=0; i<N; i++){
+            if (view.type[i] == RED){
+                vred[k++] = view.v[2*i+0];
+                vred[k++] = view.v[2*i+1];
+            }
+        }
+        corr_add(&corr_vel, vred);
+
+        corr_unwrap(xu, xprev, view.x, N, view.L, view.pbc);
+        corr_add(&corr_msd, xu);
+        #endif
+
         #ifdef PLOT
         #ifdef OPENIL
         if (key['p'] == 1)
@@ -474,33 +359,17 @@ void simulate(double alphain, double sigmain, int seed, double dampin){
         if (key['f'] == 1)
             showplot = !showplot;
         if (key['k'] == 1)
-            vhappy_red = 0.0;
+            entbody_set_speed(sim, RED, 0.0);
         if (key['q'] == 1)
             break;
-        if (key['w'] == 1){
-            for (i=0; i<N; i++){
-                if (type[i] == RED)
-                    o[2*i+1] = -kickforce;
-            }
-        }
-        if (key['s'] == 1){
-            for (i=0; i<N; i++){
-                if (type[i] == RED)
-                    o[2*i+1] = kickforce;
-            }
-        }
-        if (key['a'] == 1){
-            for (i=0; i<N; i++){
-                if (type[i] == RED)
-                    o[2*i+0] = -kickforce;
-            }
-        }
-        if (key['d'] == 1){
-            for (i=0; i<N; i++){
-                if (type[i] == RED)
-                    o[2*i+0] = kickforce;
-            }
-        }
+        if (key['w'] == 1)
+            entbody_kick(sim, 0.0, -kickforce);
+        if (key['s'] == 1)
+            entbody_kick(sim, 0.0, kickforce);
+        if (key['a'] == 1)
+            entbody_kick(sim, -kickforce, 0.0);
+        if (key['d'] == 1)
+            entbody_kick(sim, kickforce, 0.0);
         #endif
     }
     // end of the magic, cleanup
@@ -519,214 +388,71 @@ void simulate(double alphain, double sigmain, int seed, double dampin){
     fclose(file2);
     #endif
 
-    #ifdef TEMPERATURE_BINS
-    for (i=0; i<RADS; i++){
-        for (j=0; j<BINS; j++){
-            fprintf(file3, "%i ", bins[i][j]);
-        }
-        fprintf(file3, "\n");
-    }
-    fclose(file3);
+    #ifdef FIELD_SNAPSHOTS
+    fields_free(&fields);
+    fclose(file4);
     #endif
 
-    //printf("tend = %f\n", t);
-    angularmom_std    = angularmom_std    / (angularmom_count - 1);
-    angularmom_sq_std = angularmom_sq_std / (angularmom_count - 1);
- 
-    momentumx_std = momentumx_std / (momentum_count - 1);
-    momentumy_std = momentumy_std / (momentum_count - 1);
- 
-    printf("%f %f %f %f %f %f %f %f %f %f %f %f\n", 
-                                        angularmom_avg, sqrt(angularmom_std), 
-                                        angularmom_sq_avg, sqrt(angularmom_sq_std), 
-                                        momentumx_avg, sqrt(momentumx_std), 
-                                        momentumy_avg, sqrt(momentumy_std),
-                                        momentumsqx_avg, sqrt(momentumsqx_std),
-                                        momentumsqy_avg, sqrt(momentumsqy_std));
-
-    free(cells);
-    free(count);
- 
-    free(x);
-    free(v);
-    free(f);
-    free(w);
-    free(o);
-    free(neigh);
-    free(rad);
-    free(type);
-    free(col);
+    if (ftraj)
+        fclose(ftraj);
 
-    #ifdef PLOT
-    plot_clean(); 
+    #ifdef CLUSTER_ANALYSIS
+    cluster_free(&clusters);
+    fclose(file5);
     #endif
-}
-
 
+    #ifdef CORRELATORS
+    correlator_t *corrs[] = {&corr_ang, &corr_vel, &corr_msd};
+    corr_write("correlations.txt", corrs, 3, view.dt);
 
+    double D, tau;
+    corr_summary(&corr_ang, &corr_msd, corr_angavg, view.dt, &D, &tau);
+    fprintf(stderr, "D = %f tauL = %f\n", D, tau);
 
-//=================================================
-// extra stuff
-//=================================================
-void ran_seed(long j){
-  vseed = j;  vran = 4101842887655102017LL;
-  vran ^= vseed; 
-  vran ^= vran >> 21; vran ^= vran << 35; vran ^= vran >> 4;
-  vran = vran * 2685821657736338717LL;
-}
-
-double ran_ran2(){
-    vran ^= vran >> 21; vran ^= vran << 35; vran ^= vran >> 4;
-    unsigned long long int t = vran * 2685821657736338717LL;
-    return 5.42101086242752217e-20*t;
-}
-
-void init_circle(double *x, double *v, 
-                 int *type, double speed, long N, double L){
-    int i;
-    for (i=0; i<N; i++){
-        double tx = L*ran_ran2();
-        double ty = L*ran_ran2();
-        double tt = 2*pi*ran_ran2();
-
-        x[2*i+0] = tx;
-        x[2*i+1] = ty;
-        
-        // the radius for which 30% of the particles are red on avg
-        double dd = sqrt((tx-L/2)*(tx-L/2) + (ty-L/2)*(ty-L/2));
-        double rad = sqrt(0.16*L*L / pi);
-
-        //if (i<0.15*N)
-        if (dd < rad)
-            type[i] = RED;
-        else
-            type[i] = BLACK;
-
-        if (type[i] == RED){
-            v[2*i+0] = speed*cos(tt);
-            v[2*i+1] = speed*sin(tt);
-        }
-        else {
-            v[2*i+0] = 0.0;
-            v[2*i+1] = 0.0;
-        }
-    }   
-} 
-
-//=======================================
-// NBL - neighborlist helper functions
-//=======================================
-inline double mymod(double a, double b){
-  return a - b*(int)(a/b) + b*(a<0);
-}
-
-inline void coords_to_index(double *x, int *size, int *index, double L){   
-    index[0] = (int)(x[0]/L  * size[0]);
-    index[1] = (int)(x[1]/L  * size[1]);
-}
-
-inline int mod_rvec(int a, int b, int p, int *image){
-    *image = 1;
-    if (b==0) {if (a==0) *image=0; return 0;}
-    if (p != 0){
-        if (a>b)  return a-b-1;
-        if (a<0)  return a+b+1;
-    } else {
-        if (a>b)  return b;
-        if (a<0)  return 0;
-    }
-    *image = 0;
-    return a;
-}
-
-
-
-//==========================================
-// measurement functions
-//=========================================
-void centerofmass(double *x, int *t, int N, double L, double *cmx, double *cmy){
-    int i;
-    double xreal = 0.0;
-    double ximag = 0.0;
-    double yreal = 0.0;
-    double yimag = 0.0;
+    corr_free(&corr_ang);
+    corr_free(&corr_vel);
+    corr_free(&corr_msd);
+    free(vred);
+    free(xu);
+    free(xprev);
+    #endif
 
-    for (i=0; i<N; i++){
-        if (t[i] == RED){
-            xreal += cos(2*pi/L * x[2*i+0]);
-            ximag += sin(2*pi/L * x[2*i+0]);
-            yreal += cos(2*pi/L * x[2*i+1]);
-            yimag += sin(2*pi/L * x[2*i+1]);
+    #ifdef TEMPERATURE_BINS
+    for (i=0; i<RADS; i++){
+        for (j=0; j<BINS; j++){
+            fprintf(file3, "%i ", bins[i][j]);
         }
+        fprintf(file3, "\n");
     }
+    fclose(file3);
+    #endif
 
-    *cmx = atan2(ximag,xreal)/(2*pi) * L;
-    *cmy = atan2(yimag,yreal)/(2*pi) * L;
-
-    if (*cmx < 0) *cmx += L;
-    if (*cmy < 0) *cmy += L;
-}
-
+    double avg[EQUIL_NOBS], std[EQUIL_NOBS], sem[EQUIL_NOBS];
+    long trunc = equil_truncation(&eq, monitored, 3);
+    long nsamp = equil_stats(&eq, trunc, avg, std, sem);
 
-double angularmom(double *x, double *v, int *t, int N, double L, int *pbc){
-    int i=0;
-    double ang = 0.0;
-    double cmx = 0.0;
-    double cmy = 0.0;
-    int count = 0;
-
-    centerofmass(x, t, N, L, &cmx, &cmy);
-
-    for (i=0; i<N; i++){
-        if (t[i] == RED){
-            double tx = x[2*i+0] - cmx;
-            double ty = x[2*i+1] - cmy;
-            
-            if (pbc[0] && tx > L/2)  tx -= L;
-            if (pbc[1] && ty > L/2)  ty -= L;
-            if (pbc[0] && tx < -L/2) tx += L;
-            if (pbc[1] && ty < -L/2) ty += L;
-    
-            double vx = v[2*i+0];
-            double vy = v[2*i+1];
-            double tv = vx*ty - vy*tx;
-            ang += tv;
-            count++;
-        }
+    // effective number of independent samples of the worst series
+    double neff = nsamp;
+    for (i=0; i<3; i++){
+        k = monitored[i];
+        if (sem[k] > 0 && std[k]*std[k]/(sem[k]*sem[k]) < neff)
+            neff = std[k]*std[k]/(sem[k]*sem[k]);
     }
+    fprintf(stderr, "tend = %f tequil = %f nsamples = %li neff = %f\n",
+            t, trunc*EQUIL_BATCH*view.dt, nsamp, neff);
 
-    return ang/count;
-}
-
-
-void temperature(double *x, double *v, int *t, int N, double L, int *pbc, int bins[RADS][BINS]){
-    int i=0;
-    double cmx = 0.0;
-    double cmy = 0.0;
-    int count = 0;
-
-    centerofmass(x, t, N, L, &cmx, &cmy);
-
-    for (i=0; i<N; i++){
-        if (t[i] == RED){
-            double dx = x[2*i+0] - cmx;
-            double dy = x[2*i+1] - cmy;
-            if (pbc[0] && dx > L/2)  dx -= L;
-            if (pbc[1] && dy > L/2)  dy -= L;
-            if (pbc[0] && dx < -L/2) dx += L;
-            if (pbc[1] && dy < -L/2) dy += L;
+    printf("%f %f %f %f %f %f %f %f %f %f %f %f\n", 
+                                        avg[0], std[0], avg[1], std[1],
+                                        avg[2], std[2], avg[3], std[3],
+                                        avg[4], std[4], avg[5], std[5]);
+    equil_free(&eq);
 
-            double rr = sqrt(dx*dx + dy*dy);
-            double vv = sqrt(v[2*i+0]*v[2*i+0] + v[2*i+1]*v[2*i+1]);
+    if (opts->output && !entbody_save(sim, opts->output))
+        fprintf(stderr, "could not save the state to %s\n", opts->output);
+    entbody_destroy(sim);
 
-            int rad = RADS * 2*rr/L;
-            int bin = BINS * vv/3;
-            if (rad < RADS && bin < BINS){
-                bins[rad][bin]++;
-            }
-            count++;
-        }
-    }
+    #ifdef PLOT
+    free(dens);
+    plot_clean(); 
+    #endif
 }
-
-
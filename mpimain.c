@@ -0,0 +1,150 @@
+//===================================================
+// Project: Collective motion at heavy metal concerts
+//===================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <mpi.h>
+#include "entbody.h"
+#include "equil.h"
+#include "domain.h"
+
+//===================================================
+// headless driver for the domain decomposed run.  it
+// takes the same arguments as entbody and prints the
+// same line, e.g.
+//   mpirun -np 4 ./entbody_mpi -T 100 0.5 0.3 7 0.5
+//===================================================
+typedef struct {
+    long   N;
+    double tol;
+    double tmax;
+    char  *input;
+    char  *output;
+} options_t;
+
+void simulate(double alpha, double sigma, int seed, double damp, options_t *opts);
+
+int main(int argc, char **argv){
+    double alpha_in = 0.9;
+    double sigma_in = 0.1;
+    double damp_in  = 1.0;
+    int seed_in     = 0;
+    int rank;
+
+    MPI_Init(&argc, &argv);
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    options_t opts;
+    opts.N      = 1000;
+    opts.tol    = 0.0;
+    opts.tmax   = 0.0;
+    opts.input  = NULL;
+    opts.output = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "e:T:N:i:o:")) != -1){
+        switch (opt){
+            case 'e': opts.tol    = atof(optarg); break;
+            case 'T': opts.tmax   = atof(optarg); break;
+            case 'N': opts.N      = atol(optarg); break;
+            case 'i': opts.input  = optarg; break;
+            case 'o': opts.output = optarg; break;
+            default:  argc = -1;
+        }
+    }
+
+    if (argc == optind)
+        simulate(alpha_in, sigma_in, seed_in, damp_in, &opts);
+    else if (argc - optind == 4){
+        alpha_in = atof(argv[optind+0]);
+        sigma_in = atof(argv[optind+1]);
+        seed_in  = atoi(argv[optind+2]);
+        damp_in  = atof(argv[optind+3]);
+        simulate(alpha_in, sigma_in, seed_in, damp_in, &opts);
+    }
+    else if (rank == 0){
+        printf("usage:\n");
+        printf("\tmpirun -np ranks ./entbody_mpi [-e tol] [-T tmax] [-N particles] [-i state] [-o state] [alpha] [eta] [seed] [damp]\n");
+        printf("\t  the options are those of ./entbody; the box is split into one slab per rank\n");
+    }
+    MPI_Finalize();
+    return 0;
+}
+
+void simulate(double alphain, double sigmain, int seed, double dampin, options_t *opts){
+    int i, k, rank;
+    MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+
+    entbody_t *sim = entbody_create(opts->N, alphain, sigmain, seed, dampin);
+    if (opts->input && !entbody_load(sim, opts->input) && rank == 0)
+        fprintf(stderr, "could not continue from %s, starting cold\n", opts->input);
+
+    domain_t dom;
+    if (!domain_init(&dom, sim, MPI_COMM_WORLD)){
+        if (rank == 0)
+            fprintf(stderr, "more ranks than rows of boxes\n");
+        entbody_destroy(sim);
+        return;
+    }
+
+    entbody_view_t view;
+    entbody_obs_t obs;
+    entbody_view(sim, &view);
+
+    double time_end = 1e3;
+    if (opts->tmax > 0)
+        time_end = opts->tmax;
+
+    equil_t eq;
+    equil_init(&eq);
+    int monitored[] = {0, 2, 3};
+
+    double t = 0.0;
+    while (t < time_end){
+        domain_step(&dom);
+        domain_observe(&dom, &obs);
+        t = obs.t;
+
+        double obsv[EQUIL_NOBS] = {obs.angularmom, obs.angularmom*obs.angularmom,
+                                   obs.momentumx, obs.momentumy,
+                                   obs.momentumx*obs.momentumx, obs.momentumy*obs.momentumy};
+        equil_add(&eq, obsv);
+
+        // every rank holds the same reduced series, so they agree
+        if (opts->tol > 0 && eq.nsamp == 0 && eq.nbatch % 10 == 0 &&
+            equil_converged(&eq, monitored, 3, opts->tol))
+            break;
+    }
+
+    double avg[EQUIL_NOBS], std[EQUIL_NOBS], sem[EQUIL_NOBS];
+    long trunc = equil_truncation(&eq, monitored, 3);
+    long nsamp = equil_stats(&eq, trunc, avg, std, sem);
+
+    double neff = nsamp;
+    for (i=0; i<3; i++){
+        k = monitored[i];
+        if (sem[k] > 0 && std[k]*std[k]/(sem[k]*sem[k]) < neff)
+            neff = std[k]*std[k]/(sem[k]*sem[k]);
+    }
+
+    if (rank == 0){
+        fprintf(stderr, "tend = %f tequil = %f nsamples = %li neff = %f\n",
+                t, trunc*EQUIL_BATCH*view.dt, nsamp, neff);
+
+        printf("%f %f %f %f %f %f %f %f %f %f %f %f\n",
+                                        avg[0], std[0], avg[1], std[1],
+                                        avg[2], std[2], avg[3], std[3],
+                                        avg[4], std[4], avg[5], std[5]);
+    }
+    equil_free(&eq);
+
+    if (opts->output){
+        domain_gather(&dom);
+        if (rank == 0 && !entbody_save(sim, opts->output))
+            fprintf(stderr, "could not save the state to %s\n", opts->output);
+    }
+    domain_free(&dom);
+    entbody_destroy(sim);
+}
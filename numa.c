@@ -0,0 +1,183 @@
+//===================================================
+// Project: Collective motion at heavy metal concerts
+//===================================================
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "numa.h"
+
+#ifdef __linux__
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#ifdef OPENMP
+#include <omp.h>
+#endif
+
+#define HUGEPAGE  (2UL<<20)
+#define CACHELINE 64
+
+//=================================================
+// arenas: one mapping carved into page aligned
+// arrays.  nothing is written here, the caller does
+// the first touch from the threads that use the data.
+// any arena of a huge page or more is backed by huge
+// pages (explicit, else transparent).  narrays is the
+// number of arrays to be carved and slice the smallest
+// per thread part of any of them: once a slice spans a
+// huge page the arrays start on huge page boundaries,
+// below that on small pages inside the huge ones, and
+// threads whose slices meet in a huge page share it
+//=================================================
+void arena_init(arena_t *a, size_t bytes, int narrays, size_t slice){
+    a->used = 0;
+    a->huge = 0;
+
+    #ifdef __linux__
+    a->page  = slice >= HUGEPAGE ? HUGEPAGE : (size_t)sysconf(_SC_PAGESIZE);
+    a->bytes = bytes + narrays*a->page + 1;
+
+    if (a->bytes >= HUGEPAGE){
+        a->bytes = (a->bytes + HUGEPAGE - 1) & ~(HUGEPAGE - 1);
+        a->base  = (char*)mmap(NULL, a->bytes, PROT_READ|PROT_WRITE,
+                        MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+        if (a->base != MAP_FAILED){
+            a->huge = 1;
+            return;
+        }
+
+        // fall back to transparent huge pages when they are enabled,
+        // starting the first array on a huge page boundary
+        a->bytes += HUGEPAGE;
+        a->base = (char*)mmap(NULL, a->bytes, PROT_READ|PROT_WRITE,
+                        MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (a->base == MAP_FAILED){
+            fprintf(stderr, "arena: could not map %zu bytes\n", a->bytes);
+            exit(1);
+        }
+        madvise(a->base, a->bytes, MADV_HUGEPAGE);
+        a->used = (HUGEPAGE - (uintptr_t)a->base % HUGEPAGE) % HUGEPAGE;
+        return;
+    }
+
+    a->base = (char*)mmap(NULL, a->bytes, PROT_READ|PROT_WRITE,
+                    MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if (a->base == MAP_FAILED){
+        fprintf(stderr, "arena: could not map %zu bytes\n", a->bytes);
+        exit(1);
+    }
+    #else
+    a->page  = CACHELINE;
+    a->bytes = bytes + narrays*CACHELINE + 1;
+    if (posix_memalign((void**)&a->base, CACHELINE, a->bytes)){
+        fprintf(stderr, "arena: could not allocate %zu bytes\n", a->bytes);
+        exit(1);
+    }
+    #endif
+}
+
+void *arena_carve(arena_t *a, size_t bytes){
+    uintptr_t addr = ((uintptr_t)(a->base + a->used) + a->page - 1) & ~(uintptr_t)(a->page - 1);
+    size_t start = addr - (uintptr_t)a->base;
+    if (start + bytes > a->bytes){
+        fprintf(stderr, "arena: out of space (%zu of %zu bytes)\n", start + bytes, a->bytes);
+        exit(1);
+    }
+    a->used = start + bytes;
+    return a->base + start;
+}
+
+void arena_free(arena_t *a){
+    #ifdef __linux__
+    munmap(a->base, a->bytes);
+    #else
+    free(a->base);
+    #endif
+    a->base = NULL;
+}
+
+//=================================================
+// thread affinity.  the OpenMP threads are pinned one
+// per cpu of the process mask, ordered by socket
+//=================================================
+int pin_mode(const char *name){
+    if (strcmp(name, "compact") == 0) return PIN_COMPACT;
+    if (strcmp(name, "scatter") == 0) return PIN_SCATTER;
+    return -1;
+}
+
+#if defined(__linux__) && defined(OPENMP)
+static int cpu_package(int cpu){
+    char name[128];
+    int pkg = 0;
+    sprintf(name, "/sys/devices/system/cpu/cpu%i/topology/physical_package_id", cpu);
+    FILE *file = fopen(name, "r");
+    if (file){
+        if (fscanf(file, "%i", &pkg) != 1) pkg = 0;
+        fclose(file);
+    }
+    return pkg;
+}
+#endif
+
+int pin_threads(int mode){
+    #if defined(__linux__) && defined(OPENMP)
+    static int cpus[CPU_SETSIZE], pkgs[CPU_SETSIZE], order[CPU_SETSIZE];
+    cpu_set_t allowed;
+    int i, p, n = 0, npkg = 0;
+
+    if (mode == PIN_NONE)
+        return 0;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed))
+        return 0;
+
+    for (i=0; i<CPU_SETSIZE; i++){
+        if (CPU_ISSET(i, &allowed)){
+            cpus[n] = i;
+            pkgs[n] = cpu_package(i);
+            if (pkgs[n]+1 > npkg) npkg = pkgs[n]+1;
+            n++;
+        }
+    }
+
+    // compact: socket by socket.  scatter: deal the cpus
+    // of each socket out in turn
+    int m = 0;
+    if (mode == PIN_COMPACT){
+        for (p=0; p<npkg; p++)
+            for (i=0; i<n; i++)
+                if (pkgs[i] == p) order[m++] = cpus[i];
+    }
+    else {
+        int *next = (int*)calloc(npkg, sizeof(int));
+        while (m < n){
+            for (p=0; p<npkg; p++){
+                for (i=next[p]; i<n; i++)
+                    if (pkgs[i] == p) break;
+                next[p] = i+1;
+                if (i < n) order[m++] = cpus[i];
+            }
+        }
+        free(next);
+    }
+
+    int nthreads = 0;
+    #pragma omp parallel
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(order[omp_get_thread_num() % n], &set);
+        sched_setaffinity(0, sizeof(set), &set);
+
+        #pragma omp single
+        nthreads = omp_get_num_threads();
+    }
+    return nthreads;
+    #else
+    return 0;
+    #endif
+}
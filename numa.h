@@ -0,0 +1,33 @@
+#ifndef __NUMA_H__
+#define __NUMA_H__
+
+#include <stddef.h>
+
+//===================================================
+// memory placement and thread affinity for nodes with
+// several sockets.  arenas are page aligned and left
+// untouched, so the first write decides which socket
+// each page lives on.  every carved array starts on a
+// page boundary, a huge one once the per thread slices
+// span a huge page
+//===================================================
+#define PIN_NONE    0
+#define PIN_COMPACT 1   // fill one socket before the next
+#define PIN_SCATTER 2   // round robin over the sockets
+
+typedef struct {
+    char   *base;
+    size_t bytes;
+    size_t used;
+    size_t page;        // alignment of the carved arrays
+    int    huge;        // backed by explicit huge pages
+} arena_t;
+
+void  arena_init(arena_t *a, size_t bytes, int narrays, size_t slice);
+void *arena_carve(arena_t *a, size_t bytes);
+void  arena_free(arena_t *a);
+
+int   pin_mode(const char *name);     // -1 for an unknown name
+int   pin_threads(int mode);
+
+#endif
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include "plot.h"
 
@@ -9,6 +10,23 @@ int plot_sizex;
 int plot_sizey;
 int win;
 
+//=============================================================
+// zoom ('=' and '-' about the center of the box) and the
+// level of detail switch: once particles are below
+// PLOT_LOD_PIXELS across or more than PLOT_LOD_DISCS would be
+// drawn, the boxes are drawn as one density texture instead
+//=============================================================
+#define PLOT_LOD_PIXELS   1.0
+#define PLOT_LOD_DISCS    250000
+#define PLOT_GLYPH_PIXELS 16
+#define PLOT_ZOOM_MAX     64.0
+
+double plot_zoom = 1.0;
+double plot_view[4];     // visible xmin, xmax, ymin, ymax
+GLuint plot_tex = 0;
+unsigned char *plot_texdata = NULL;
+int plot_texsize = 0;
+
 void key_down(unsigned char key, int x, int y){
   keys[key] = 1;
 }
@@ -60,6 +78,10 @@ void plot_end_opengl(){
   glutDestroyWindow(win);
 }
 
+void plot_set_title(const char *title){
+  glutSetWindowTitle(title);
+}
+
 int plot_clear_screen(){
   glClear(GL_COLOR_BUFFER_BIT);
   return 1;
@@ -91,6 +113,35 @@ void plot_saveimage(const char* name){
 }
 #endif
 
+static void plot_set_view(double L){
+    if (keys['='] == 1 && plot_zoom < PLOT_ZOOM_MAX) plot_zoom *= 1.05;
+    if (keys['-'] == 1 && plot_zoom > 1.0)           plot_zoom /= 1.05;
+    if (plot_zoom < 1.0) plot_zoom = 1.0;
+
+    double half = L / (2*plot_zoom);
+    plot_view[0] = L/2 - half;
+    plot_view[1] = L/2 + half;
+    plot_view[2] = L/2 - half;
+    plot_view[3] = L/2 + half;
+
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    glOrtho(plot_view[0], plot_view[1], plot_view[3], plot_view[2], 0, 1);
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+}
+
+static int plot_visible(double x, double y, double pad){
+    return x >= plot_view[0]-pad && x <= plot_view[1]+pad &&
+           y >= plot_view[2]-pad && y <= plot_view[3]+pad;
+}
+
+int plot_use_density(long N, double L, double rad){
+    double pixels  = 2*rad * plot_zoom * plot_sizex / L;
+    double visible = N / (plot_zoom*plot_zoom);
+    return pixels < PLOT_LOD_PIXELS || visible > PLOT_LOD_DISCS;
+}
+
 void draw_arrow(double px, double py, double vx, double vy, int inverse){
     GLfloat savedLineWidth = 1.0f;
     glGetFloatv(GL_LINE_WIDTH, &savedLineWidth);
@@ -135,11 +186,7 @@ void draw_arrow(double px, double py, double vx, double vy, int inverse){
 int *plot_render_particles(double *x, double *rad, int *type, long N, double L, double *shade, int forces,
                            double cmx, double cmy, int docom, int *pbc, double *v, int doarrows){
     // focus on the part of scene where we draw nice
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    glOrtho(0, L, L, 0, 0, 1);
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
+    plot_set_view(L);
 
     // lets draw our viewport just in case its not square
     glBegin(GL_LINE_LOOP);
@@ -169,6 +216,8 @@ int *plot_render_particles(double *x, double *rad, int *type, long N, double L,
     for (i=0; i<N; i++){
         tx = (float)x[2*i+0];
         ty = (float)x[2*i+1];
+        if (plot_zoom > 1.0 && !plot_visible(tx, ty, 2*rad[i]))
+            continue;
 
         if (forces){
             c = fabs(shade[i]);
@@ -214,7 +263,8 @@ int *plot_render_particles(double *x, double *rad, int *type, long N, double L,
 
     if (doarrows)
         for (i=0; i<N; i++)
-            if (type[i] == 1) draw_arrow(x[2*i+0], x[2*i+1], v[2*i+0], v[2*i+1], forces);
+            if (type[i] == 1 && (plot_zoom == 1.0 || plot_visible(x[2*i+0], x[2*i+1], 2*rad[i])))
+                draw_arrow(x[2*i+0], x[2*i+1], v[2*i+0], v[2*i+1], forces);
     #ifdef OPENMP 
     //#pragma omp barrier
     #endif
@@ -261,6 +311,106 @@ int *plot_render_particles(double *x, double *rad, int *type, long N, double L,
     return keys;
 }
 
+//=============================================================
+// density view: dens is [4][ny][nx] RED and BLACK counts and
+// mean velocity per box (entbody_density).  the area fractions
+// shade one texture over the box, and the mean velocity of
+// every few boxes is drawn as a line glyph
+//=============================================================
+int *plot_render_density(float *dens, int nx, int ny, double L, double rad,
+                         int forces, int doarrows){
+    int n = nx*ny;
+    int c;
+    double area = (L/nx) * (L/ny);
+    double disc = pi*rad*rad;
+
+    float red[3]   = {0.9, 0.05, 0.05};
+    float black[3] = {0.55, 0.55, 0.55};
+    if (!forces)
+        red[0] = red[1] = red[2] = 0.0;
+
+    if (plot_texsize < n){
+        plot_texdata = (unsigned char*)realloc(plot_texdata, 4*n);
+        plot_texsize = n;
+    }
+
+    #ifdef OPENMP
+    #pragma omp parallel for schedule(static)
+    #endif
+    for (c=0; c<n; c++){
+        double pr = dens[0*n+c] * disc / area;
+        double pb = dens[1*n+c] * disc / area;
+        int k;
+        if (pr + pb > 1.0){
+            double scale = 1.0 / (pr + pb);
+            pr *= scale;
+            pb *= scale;
+        }
+        for (k=0; k<3; k++){
+            double col = (1.0 - pr - pb) + pr*red[k] + pb*black[k];
+            plot_texdata[4*c+k] = (unsigned char)(255*col);
+        }
+        plot_texdata[4*c+3] = 255;
+    }
+
+    plot_set_view(L);
+
+    if (plot_tex == 0)
+        glGenTextures(1, &plot_tex);
+    glBindTexture(GL_TEXTURE_2D, plot_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, nx, ny, 0, GL_RGBA, GL_UNSIGNED_BYTE, plot_texdata);
+
+    glEnable(GL_TEXTURE_2D);
+    glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+    glBegin(GL_QUADS);
+      glTexCoord2f(0, 0); glVertex2f(0, 0);
+      glTexCoord2f(1, 0); glVertex2f(L, 0);
+      glTexCoord2f(1, 1); glVertex2f(L, L);
+      glTexCoord2f(0, 1); glVertex2f(0, L);
+    glEnd();
+    glDisable(GL_TEXTURE_2D);
+
+    plot_set_draw_color(0.0,0.0,0.0,1.0);
+    glBegin(GL_LINE_LOOP);
+      glVertex2f(0, 0);
+      glVertex2f(0, L);
+      glVertex2f(L, L);
+      glVertex2f(L, 0);
+    glEnd();
+
+    if (doarrows){
+        double bx = L/nx, by = L/ny;
+        double pixels = plot_sizex * plot_zoom / nx;
+        int stride = (int)ceil(PLOT_GLYPH_PIXELS / pixels);
+        int cx, cy;
+        if (stride < 1) stride = 1;
+
+        // a speed of one spans most of the spacing of the glyphs
+        double scale = 0.8 * stride * bx;
+        plot_set_draw_color(red[0], red[1], red[2], 1.0);
+        glBegin(GL_LINES);
+        for (cy=stride/2; cy<ny; cy+=stride){
+            for (cx=stride/2; cx<nx; cx+=stride){
+                double px = (cx+0.5)*bx, py = (cy+0.5)*by;
+                c = cx + cy*nx;
+                if (dens[0*n+c] + dens[1*n+c] == 0 || !plot_visible(px, py, scale))
+                    continue;
+                glVertex2f(px, py);
+                glVertex2f(px + scale*dens[2*n+c], py + scale*dens[3*n+c]);
+            }
+        }
+        glEnd();
+    }
+
+    glutSwapBuffers();
+    glutMainLoopEvent();
+
+    return keys;
+}
+
 void plot_set_draw_color(float cr, float cg, float cb, float ca){
   glColor4f(cr, cg, cb, ca);
 }
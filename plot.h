@@ -15,7 +15,11 @@ void plot_clean();
 int *plot_render_particles(double *x, double *r, int *c, 
     long N, double L, double *shade, int forces, 
     double cx, double cy, int go, int *pbc, double *v, int doarrows);
+int *plot_render_density(float *dens, int nx, int ny, double L, double rad,
+    int forces, int doarrows);
+int plot_use_density(long N, double L, double rad);
 int plot_clear_screen();
+void plot_set_title(const char *title);
 int plot_exit_func();
 
 void plot_init_opengl();
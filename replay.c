@@ -0,0 +1,226 @@
+//===================================================
+// Project: Collective motion at heavy metal concerts
+//===================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "traj.h"
+#include "plot.h"
+
+//===================================================
+// replay of a trajectory recorded with ./entbody -r.
+// nothing is simulated: each shown frame is decoded
+// from the mapped file and drawn, so a long run can be
+// scrubbed at the speed of drawing alone.
+//   space       pause / resume
+//   , .         one frame back / forward
+//   [ ]         halve / double the rate (frames per draw)
+//   r           reverse
+//   j l         seek back / forward a tenth of the run
+//   0-9         jump to that tenth of the run
+//   f           shade by force
+//   = -         zoom
+//   q           quit
+// rates above one skip the frames in between without
+// touching them, rates below one hold each frame
+//===================================================
+#define REPLAY_FPS      60
+#define REPLAY_RATE_MIN (1.0/16)
+#define REPLAY_RATE_MAX 4096.0
+#define REPLAY_BOXES_MAX 2048
+#define SHOWVELOCITYARROWS 1
+
+typedef struct {
+    long   start;       // first frame shown
+    double rate;        // frames advanced per draw
+    int    paused;
+} options_t;
+
+void replay(const char *name, options_t *opts);
+
+int main(int argc, char **argv){
+    options_t opts;
+    opts.start  = 0;
+    opts.rate   = 1.0;
+    opts.paused = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:r:P")) != -1){
+        switch (opt){
+            case 's': opts.start  = atol(optarg); break;
+            case 'r': opts.rate   = atof(optarg); break;
+            case 'P': opts.paused = 1; break;
+            default:  argc = -1;
+        }
+    }
+
+    if (argc - optind == 1)
+        replay(argv[optind], &opts);
+    else {
+        printf("usage:\n");
+        printf("\t./replay [-s frame] [-r rate] [-P] trajectory\n");
+        printf("\t  -s  first frame to show (default 0)\n");
+        printf("\t  -r  frames advanced per draw, fractions for slow motion (default 1)\n");
+        printf("\t  -P  start paused\n");
+    }
+    return 0;
+}
+
+//===================================================
+// the density view needs boxes, which the recording
+// does not have; bin the frame on a grid of about one
+// particle diameter
+//===================================================
+static void replay_density(traj_t *tr, double *x, double *v, float *dens, int nb){
+    long N = tr->N;
+    int n = nb*nb;
+    long i;
+    int c;
+
+    memset(dens, 0, sizeof(float)*4*n);
+    for (i=0; i<N; i++){
+        double bx = x[2*i+0] / tr->L * nb;
+        double by = x[2*i+1] / tr->L * nb;
+        int cx = bx > 0 ? (bx < nb ? (int)bx : nb-1) : 0;
+        int cy = by > 0 ? (by < nb ? (int)by : nb-1) : 0;
+        c = cx + cy*nb;
+        dens[(tr->type[i] == RED ? 0 : 1)*n + c] += 1;
+        dens[2*n+c] += v[2*i+0];
+        dens[3*n+c] += v[2*i+1];
+    }
+    for (c=0; c<n; c++){
+        float count = dens[0*n+c] + dens[1*n+c];
+        if (count > 0){
+            dens[2*n+c] /= count;
+            dens[3*n+c] /= count;
+        }
+    }
+}
+
+static double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+void replay(const char *name, options_t *opts){
+    traj_t tr;
+    long i;
+
+    if (!traj_open(&tr, name)){
+        fprintf(stderr, "%s is not a readable trajectory\n", name);
+        return;
+    }
+    if (tr.nframes == 0){
+        fprintf(stderr, "%s has no frames\n", name);
+        traj_close(&tr);
+        return;
+    }
+    long N = tr.N;
+    fprintf(stderr, "%li particles, %li frames every %li steps\n", N, tr.nframes, tr.stride);
+
+    double *x   = (double*)malloc(sizeof(double)*2*N);
+    double *v   = (double*)malloc(sizeof(double)*2*N);
+    double *col = (double*)malloc(sizeof(double)*N);
+    double *rad = (double*)malloc(sizeof(double)*N);
+    double rmax = 0.0;
+    for (i=0; i<N; i++){
+        rad[i] = tr.rad[i];
+        if (rad[i] > rmax) rmax = rad[i];
+    }
+
+    int nb = REPLAY_BOXES_MAX;
+    if (rmax > 0 && tr.L / (2*rmax) < REPLAY_BOXES_MAX)
+        nb = (int)(tr.L / (2*rmax));
+    if (nb < 1) nb = 1;
+    float *dens = (float*)malloc(sizeof(float)*4*nb*nb);
+
+    plot_init();
+
+    double pos  = opts->start;
+    if (pos < 0) pos = 0;
+    if (pos > tr.nframes-1) pos = tr.nframes-1;
+    double rate = opts->rate;
+    int paused  = opts->paused;
+    int dir     = 1;
+    int forces  = 0;
+    long shown  = -1;
+    double t    = 0.0;
+    int prev[256];
+    char title[256];
+    memset(prev, 0, sizeof(prev));
+
+    int *key = NULL;
+    while (1){
+        double tstart = now();
+
+        long k = (long)pos;
+        if (k != shown){
+            t = traj_frame(&tr, k, x, v, col);
+            shown = k;
+        }
+        if (!paused)
+            traj_prefetch(&tr, (long)(pos + dir*rate));
+
+        snprintf(title, sizeof(title), "replay %s  frame %li/%li  t = %.2f  rate %g%s%s",
+                 name, k, tr.nframes, t, dir*rate, paused ? "  paused" : "",
+                 forces ? "  forces" : "");
+        plot_set_title(title);
+
+        plot_clear_screen();
+        if (plot_use_density(N, tr.L, rad[0])){
+            replay_density(&tr, x, v, dens, nb);
+            key = plot_render_density(dens, nb, nb, tr.L, rad[0], forces, SHOWVELOCITYARROWS);
+        }
+        else
+            key = plot_render_particles(x, rad, tr.type, N, tr.L, col, forces,
+                    0, 0, 0, tr.pbc, v, SHOWVELOCITYARROWS);
+
+        //-------------------------------------------
+        // keys act once per press
+        int hit[256];
+        for (i=0; i<256; i++){
+            hit[i] = key[i] == 1 && prev[i] == 0;
+            prev[i] = key[i];
+        }
+
+        if (hit['q']) break;
+        if (hit[' ']) paused = !paused;
+        if (hit['r']) dir = -dir;
+        if (hit['f']) forces = !forces;
+        if (hit[']'] && rate < REPLAY_RATE_MAX) rate *= 2;
+        if (hit['['] && rate > REPLAY_RATE_MIN) rate /= 2;
+        if (hit['.']) pos = floor(pos) + 1;
+        if (hit[',']) pos = floor(pos) - 1;
+        if (hit['l']) pos += tr.nframes / 10.0;
+        if (hit['j']) pos -= tr.nframes / 10.0;
+        for (i=0; i<10; i++)
+            if (hit['0'+i]) pos = tr.nframes * i / 10.0;
+
+        if (!paused)
+            pos += dir*rate;
+
+        // hold at the ends rather than wrap around
+        if (pos < 0) pos = 0;
+        if (pos > tr.nframes-1) pos = tr.nframes-1;
+
+        double wait = 1.0/REPLAY_FPS - (now() - tstart);
+        if (wait > 0){
+            struct timespec ts;
+            ts.tv_sec  = 0;
+            ts.tv_nsec = (long)(wait*1e9);
+            nanosleep(&ts, NULL);
+        }
+    }
+
+    plot_clean();
+    free(x);
+    free(v);
+    free(col);
+    free(rad);
+    free(dens);
+    traj_close(&tr);
+}
@@ -0,0 +1,159 @@
+import numpy as np
+import ctypes as ct
+import os
+
+#===============================================
+# in-process bindings to libentbody.so (make lib)
+#
+#   sim = Entbody(alpha, eta, seed, damp)
+#   sim.step(1000)
+#   sim.x, sim.v  -> numpy views of the live arrays
+#   sim.observe() -> dict of the global observables
+#
+# the arrays are not copied, so they change as the
+# simulation advances.  take a .copy() to keep them
+#===============================================
+ABI_VERSION = 6
+RADS, BINS = 10, 50
+BLACK, RED = 0, 1
+
+class View(ct.Structure):
+    _fields_ = [("N", ct.c_long), ("L", ct.c_double), ("t", ct.c_double),
+                ("dt", ct.c_double), ("step", ct.c_long), ("pbc", ct.c_int*2),
+                ("x", ct.POINTER(ct.c_double)), ("v", ct.POINTER(ct.c_double)),
+                ("rad", ct.POINTER(ct.c_double)), ("col", ct.POINTER(ct.c_double)),
+                ("type", ct.POINTER(ct.c_int))]
+
+class Obs(ct.Structure):
+    _fields_ = [("t", ct.c_double), ("angularmom", ct.c_double),
+                ("momentumx", ct.c_double), ("momentumy", ct.c_double),
+                ("cmx", ct.c_double), ("cmy", ct.c_double)]
+
+def loadLibrary(path=None):
+    if path is None:
+        path = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "libentbody.so")
+    lib = ct.CDLL(path)
+    lib.entbody_abi_version.restype = ct.c_int
+    lib.entbody_create.restype = ct.c_void_p
+    lib.entbody_create.argtypes = [ct.c_long, ct.c_double, ct.c_double, ct.c_int, ct.c_double]
+    lib.entbody_destroy.argtypes = [ct.c_void_p]
+    lib.entbody_step.argtypes = [ct.c_void_p, ct.c_long]
+    lib.entbody_view.argtypes = [ct.c_void_p, ct.POINTER(View)]
+    lib.entbody_observe.argtypes = [ct.c_void_p, ct.POINTER(Obs)]
+    lib.entbody_temperature.argtypes = [ct.c_void_p, ct.POINTER(ct.c_int)]
+    lib.entbody_density.argtypes = [ct.c_void_p, ct.POINTER(ct.c_int), ct.POINTER(ct.c_int), ct.c_void_p]
+    lib.entbody_set_grid.argtypes = [ct.c_void_p, ct.c_int]
+    lib.entbody_set_packing.argtypes = [ct.c_void_p, ct.c_double]
+    lib.entbody_autotune.argtypes = [ct.c_void_p, ct.c_char_p]
+    lib.entbody_set_fused.argtypes = [ct.c_void_p, ct.c_int]
+    lib.entbody_hold.argtypes = [ct.c_void_p, ct.c_int]
+    lib.entbody_set_speed.argtypes = [ct.c_void_p, ct.c_int, ct.c_double]
+    lib.entbody_kick.argtypes = [ct.c_void_p, ct.c_double, ct.c_double]
+    lib.entbody_save.argtypes = [ct.c_void_p, ct.c_char_p]
+    lib.entbody_load.argtypes = [ct.c_void_p, ct.c_char_p]
+
+    if lib.entbody_abi_version() != ABI_VERSION:
+        raise RuntimeError("libentbody ABI version %i, expected %i" % (lib.entbody_abi_version(), ABI_VERSION))
+    return lib
+
+class Entbody(object):
+    lib = None
+
+    def __init__(self, alpha=0.9, eta=0.1, seed=0, damp=1.0, N=1000):
+        if Entbody.lib is None:
+            Entbody.lib = loadLibrary()
+        self.sim = Entbody.lib.entbody_create(N, alpha, eta, seed, damp)
+
+    def __del__(self):
+        if self.sim is not None:
+            Entbody.lib.entbody_destroy(self.sim)
+            self.sim = None
+
+    def step(self, n=1):
+        Entbody.lib.entbody_step(self.sim, n)
+
+    def view(self):
+        view = View()
+        Entbody.lib.entbody_view(self.sim, ct.byref(view))
+        return view
+
+    def _array(self, ptr, shape):
+        return np.ctypeslib.as_array(ptr, shape=shape)
+
+    # the views are fetched on every access so they always
+    # point at the arrays the simulation currently uses
+    @property
+    def x(self):
+        v = self.view()
+        return self._array(v.x, (v.N, 2))
+
+    @property
+    def v(self):
+        v = self.view()
+        return self._array(v.v, (v.N, 2))
+
+    @property
+    def rad(self):
+        v = self.view()
+        return self._array(v.rad, (v.N,))
+
+    @property
+    def type(self):
+        v = self.view()
+        return self._array(v.type, (v.N,))
+
+    @property
+    def L(self):
+        return self.view().L
+
+    @property
+    def t(self):
+        return self.view().t
+
+    def observe(self):
+        obs = Obs()
+        Entbody.lib.entbody_observe(self.sim, ct.byref(obs))
+        return dict((f[0], getattr(obs, f[0])) for f in Obs._fields_)
+
+    def temperature(self, bins=None):
+        if bins is None:
+            bins = np.zeros((RADS, BINS), dtype=np.intc)
+        Entbody.lib.entbody_temperature(self.sim, bins.ctypes.data_as(ct.POINTER(ct.c_int)))
+        return bins
+
+    def density(self):
+        nx, ny = ct.c_int(), ct.c_int()
+        Entbody.lib.entbody_density(self.sim, ct.byref(nx), ct.byref(ny), None)
+        out = np.zeros((4, ny.value, nx.value), dtype=np.float32)
+        Entbody.lib.entbody_density(self.sim, ct.byref(nx), ct.byref(ny), out.ctypes.data_as(ct.c_void_p))
+        return out
+
+    def setGrid(self, hashed=1):
+        Entbody.lib.entbody_set_grid(self.sim, hashed)
+
+    def setPacking(self, phi):
+        if not Entbody.lib.entbody_set_packing(self.sim, phi):
+            raise ValueError("packing fraction out of range")
+
+    def autotune(self, cache=".entbody_tune"):
+        Entbody.lib.entbody_autotune(self.sim, cache.encode() if cache else None)
+
+    def setFused(self, fused=1):
+        Entbody.lib.entbody_set_fused(self.sim, fused)
+
+    def hold(self, hold=1):
+        Entbody.lib.entbody_hold(self.sim, hold)
+
+    def setSpeed(self, type, vhappy):
+        Entbody.lib.entbody_set_speed(self.sim, type, vhappy)
+
+    def kick(self, fx, fy):
+        Entbody.lib.entbody_kick(self.sim, fx, fy)
+
+    def save(self, filename):
+        if not Entbody.lib.entbody_save(self.sim, filename.encode()):
+            raise IOError("could not save the state to "+filename)
+
+    def load(self, filename):
+        if not Entbody.lib.entbody_load(self.sim, filename.encode()):
+            raise IOError("could not continue from "+filename)
@@ -5,6 +5,7 @@ import scipy.optimize as opt
 import re, shutil, os
 
 from subprocess import Popen, PIPE, STDOUT
+from entbody import Entbody
 import time
 
 #===============================================
@@ -20,7 +21,10 @@ def changeLine(match, replacement, filename):
             newfile.write(line)
     shutil.move(newfl, filename)
 
-def setOptions(fps=0, opengl=0, velocities=0, temperature=0, timeseries=0):
+def setOptions(fps=0, opengl=0, velocities=0, temperature=0, timeseries=0, correlations=0, fields=0, clusters=0):
+    cclu = "" if clusters else "//"
+    cfld = "" if fields else "//"
+    ccor = "" if correlations else "//"
     cvel = "" if velocities else "//"
     ctmp = "" if temperature else "//"
     cang = "" if timeseries else "//"
@@ -29,14 +33,20 @@ def setOptions(fps=0, opengl=0, velocities=0, temperature=0, timeseries=0):
     changeLine(r"#define VELOCITY_DISTRIBUTION", cvel+"#define VELOCITY_DISTRIBUTION", "../main.c")
     changeLine(r"#define TEMPERATURE_BINS",      ctmp+"#define TEMPERATURE_BINS",      "../main.c")
     changeLine(r"#define ANGULARMOM_TIMESERIES", cang+"#define ANGULARMOM_TIMESERIES", "../main.c")
+    changeLine(r"#define CORRELATORS",           ccor+"#define CORRELATORS",           "../main.c")
+    changeLine(r"#define FIELD_SNAPSHOTS",       cfld+"#define FIELD_SNAPSHOTS",       "../main.c")
+    changeLine(r"#define CLUSTER_ANALYSIS",      cclu+"#define CLUSTER_ANALYSIS",      "../main.c")
     changeLine(r"^DOPLOT", "DOPLOT = "+dop, "../Makefile")
     changeLine(r"^FPS",    "FPS    = "+dof, "../Makefile")
     print "Now building entbody"
     os.system("cd .. && make clean && make && cd -")
 
-def launchSingleMoshpit(alpha, eta, seed, damp=1.0):
-    return Popen("nice -n 20 ../entbody "+str(alpha)+" "+str(eta)+" "+str(seed)+" "+str(damp), 
-            shell=True, stdin=PIPE, stdout=PIPE, close_fds=True)
+def buildLibrary():
+    os.system("cd .. && make lib && cd -")
+
+def launchSingleMoshpit(alpha, eta, seed, damp=1.0, opts=""):
+    return Popen("nice -n 20 ../entbody "+opts+" "+str(alpha)+" "+str(eta)+" "+str(seed)+" "+str(damp), 
+            shell=True, stdin=PIPE, stdout=PIPE, stderr=PIPE, close_fds=True)
 
 def runSingleMoshpit(alpha, eta, seed, damp=1.0):
     proc = [launchSingleMoshpit(alpha, eta, seed, damp)]
@@ -76,6 +86,260 @@ def runEntireSlice(samples=50, clump=10, alpha_range=(0.0,4.0,4.0/60), filename=
             end = time.time()
             print alpha, " ", eta, " ", end - start
 
+#=====================================================
+# adaptive sampling of the phase diagram
+#  - seeds are added to a point in clumps until the
+#    confidence intervals of |L| and the momentum
+#    variance are inside the requested tolerances
+#  - a quad of the (alpha, eta) mesh is split in four
+#    wherever the order parameters jump across it
+#=====================================================
+def launchMoshpits(alpha, eta, seeds, damp=1.0, opts=""):
+    procs = [launchSingleMoshpit(alpha, eta, s, damp, opts) for s in seeds]
+    data = []
+    while procs:
+        for p in procs:
+            retcode = p.poll()
+            if retcode is not None:
+                out = p.stdout.readlines()[-1]
+                data.append([float(o) for o in out.split()])
+                procs.remove(p)
+        time.sleep(0.05)
+    return data
+
+def orderParameters(data):
+    # per seed: |<L>| and the variance of the RED momentum
+    data = np.array(data)
+    absL = np.abs(data[:,0])
+    pvar = data[:,5]**2 + data[:,7]**2
+    return absL, pvar
+
+def sampleAdaptivePoint(alpha, eta, seed, clump=10, minseeds=10, maxseeds=200,
+        ltol=0.1, ptol=0.005, z=1.96, opts=""):
+    data = []
+    while len(data) < maxseeds:
+        data += launchMoshpits(alpha, eta, range(seed, seed+clump), opts=opts)
+        seed += clump
+        if len(data) < minseeds:
+            continue
+
+        n = len(data)
+        absL, pvar = orderParameters(data)
+        if z*absL.std(ddof=1)/np.sqrt(n) < ltol and z*pvar.std(ddof=1)/np.sqrt(n) < ptol:
+            break
+
+    absL, pvar = orderParameters(data)
+    data = np.array(data)
+    n = len(data)
+    return {"alpha": alpha, "eta": eta, "seeds": n,
+            "absL": absL.mean(), "absLerr": absL.std(ddof=1)/np.sqrt(n),
+            "pvar": pvar.mean(), "pvarerr": pvar.std(ddof=1)/np.sqrt(n),
+            "mean": data.mean(axis=0), "std": data.std(axis=0)}, seed
+
+def runAdaptiveSlice(alpha_range=(0.0,4.0), eta_range=(0.0,3.0), coarse=(8,8), levels=3,
+        threshold=0.2, clump=10, minseeds=10, maxseeds=200, ltol=0.1, ptol=0.005,
+        runtol=0.0, filename="adaptive.txt", meshname="adaptive_mesh.txt"):
+    setOptions()
+    opts = "-e "+str(runtol) if runtol > 0 else ""
+
+    points = {}
+    state = {"seed": 0}
+    def point(a, e):
+        key = (round(a, 10), round(e, 10))
+        if key not in points:
+            start = time.time()
+            points[key], state["seed"] = sampleAdaptivePoint(a, e, state["seed"], clump,
+                    minseeds, maxseeds, ltol, ptol, opts=opts)
+            print("%f %f %i %f" % (a, e, points[key]["seeds"], time.time() - start))
+        return points[key]
+
+    def jump(cell, name, scale):
+        a0, a1, e0, e1 = cell
+        vals = [point(a, e)[name] for a in (a0, a1) for e in (e0, e1)]
+        return (max(vals) - min(vals)) / scale
+
+    da = (alpha_range[1] - alpha_range[0]) / coarse[0]
+    de = (eta_range[1] - eta_range[0]) / coarse[1]
+    cells = [(alpha_range[0]+i*da, alpha_range[0]+(i+1)*da, eta_range[0]+j*de, eta_range[0]+(j+1)*de)
+                for i in range(coarse[0]) for j in range(coarse[1])]
+    leaves = []
+
+    for level in range(levels+1):
+        for c in cells:
+            for a in (c[0], c[1]):
+                for e in (c[2], c[3]):
+                    point(a, e)
+
+        # jumps are measured relative to the spread over the whole diagram
+        lscale = max(np.ptp([p["absL"] for p in points.values()]), 1e-12)
+        pscale = max(np.ptp([p["pvar"] for p in points.values()]), 1e-12)
+
+        refine = []
+        for c in cells:
+            if level < levels and (jump(c, "absL", lscale) > threshold or
+                                   jump(c, "pvar", pscale) > threshold):
+                am, em = (c[0]+c[1])/2, (c[2]+c[3])/2
+                refine += [(c[0], am, c[2], em), (am, c[1], c[2], em),
+                           (c[0], am, em, c[3]), (am, c[1], em, c[3])]
+            else:
+                leaves.append(c + (level,))
+        cells = refine
+
+    file = open(filename, "w")
+    for key in sorted(points.keys()):
+        p = points[key]
+        strout = str(p["alpha"])+" "+str(p["eta"])+" "+str(p["seeds"])+" "
+        strout += str(p["absL"])+" "+str(p["absLerr"])+" "+str(p["pvar"])+" "+str(p["pvarerr"])+" "
+        strout += " ".join([str(m) for m in p["mean"]])+" "
+        strout += " ".join([str(s) for s in p["std"]])
+        file.write(strout+"\n")
+    file.close()
+
+    file = open(meshname, "w")
+    for l in leaves:
+        file.write(" ".join([str(c) for c in l])+"\n")
+    file.close()
+    return points, leaves
+
+#=====================================================
+# continuation along a line of the phase diagram
+#  - each seed walks the line, starting every point
+#    from the final state of the previous one
+#  - direction "up", "down" or "both", the last one
+#    going up and coming back for hysteresis loops
+#  - the equilibration time (MSER truncation) of every
+#    warm start is compared with a cold start
+#=====================================================
+def readEquilibration(proc):
+    # "tend = .. tequil = .. nsamples = .. neff = .." on stderr
+    for line in proc.stderr.readlines():
+        words = line.split()
+        if len(words) >= 6 and words[0] == "tend":
+            return float(words[2]), float(words[5])
+    return 0.0, 0.0
+
+def runContinuation(proc):
+    while proc.poll() is None:
+        time.sleep(0.05)
+    tend, tequil = readEquilibration(proc)
+    out = [float(o) for o in proc.stdout.readlines()[-1].split()]
+    return out, tend, tequil
+
+def runContinuationSlice(line="alpha", fixed=0.1, values=np.arange(0.0, 4.0, 4.0/60),
+        direction="both", seeds=range(10), damp=1.0, runtol=0.0, cold=True,
+        filename="continuation.txt", statedir="states"):
+    setOptions()
+    if not os.path.exists(statedir):
+        os.makedirs(statedir)
+    opts = "-e "+str(runtol)+" " if runtol > 0 else ""
+
+    values = list(values)
+    legs = {"up": [values], "down": [values[::-1]], "both": [values, values[::-1][1:]]}[direction]
+    path = [(leg, v) for leg in range(len(legs)) for v in legs[leg]]
+
+    file = open(filename, "w")
+    saved = []
+    for seed in seeds:
+        prev = None
+        for step, (leg, v) in enumerate(path):
+            alpha, eta = (v, fixed) if line == "alpha" else (fixed, v)
+            state = os.path.join(statedir, "state_%i_%i.bin" % (seed, step))
+            start = time.time()
+
+            # chained runs get their own seed per point
+            runseed = seed*len(path) + step
+            warm = opts + ("-i "+prev+" " if prev else "") + "-o "+state
+            wp = launchSingleMoshpit(alpha, eta, runseed, damp, warm)
+            cp = launchSingleMoshpit(alpha, eta, runseed, damp, opts) if cold and prev else None
+
+            out, tend, tequil = runContinuation(wp)
+            ctend, ctequil = runContinuation(cp)[1:] if cp else (tend, tequil)
+            if prev:
+                saved.append(ctequil - tequil)
+            prev = state
+
+            strout = str(alpha)+" "+str(eta)+" "+str(seed)+" "+str(leg)+" "
+            strout += str(tend)+" "+str(tequil)+" "+str(ctend)+" "+str(ctequil)+" "
+            strout += " ".join([str(o) for o in out])
+            file.write(strout+"\n")
+            file.flush()
+            print("%f %f %i %i %f %f %f" % (alpha, eta, seed, leg, tequil, ctequil, time.time() - start))
+    file.close()
+
+    if cold and saved:
+        print("equilibration time saved per point: %f +- %f" %
+                (np.mean(saved), np.std(saved)/np.sqrt(len(saved))))
+    return np.array(saved)
+
+#=====================================================
+# coarse grained field snapshots (FIELD_SNAPSHOTS)
+#=====================================================
+FIELD_NAMES = ["rho_red", "rho_black", "vx", "vy", "px", "py", "vort"]
+
+def readFields(filename="fields.bin"):
+    snaps = []
+    data = open(filename, "rb").read()
+    pos = 0
+    while pos + 32 <= len(data):
+        nx, ny = np.frombuffer(data[pos:pos+8], dtype=np.int32)
+        L, t = np.frombuffer(data[pos+8:pos+24], dtype=np.float64)
+        nsamp = np.frombuffer(data[pos+24:pos+32], dtype=np.int64)[0]
+        pos += 32
+        size = len(FIELD_NAMES)*nx*ny*4
+        arr = np.frombuffer(data[pos:pos+size], dtype=np.float32).reshape(len(FIELD_NAMES), ny, nx)
+        pos += size
+        snap = {"t": t, "L": L, "samples": nsamp}
+        for i in range(len(FIELD_NAMES)):
+            snap[FIELD_NAMES[i]] = arr[i]
+        snaps.append(snap)
+    return snaps
+
+def radialProfile(field, L, bins=10):
+    # fields are centered on the RED center of mass
+    ny, nx = field.shape
+    xs = (np.arange(nx) + 0.5) * L/nx - L/2
+    ys = (np.arange(ny) + 0.5) * L/ny - L/2
+    r = np.sqrt(xs[None,:]**2 + ys[:,None]**2)
+    edges = np.linspace(0, L/2, bins+1)
+    which = np.digitize(r.ravel(), edges) - 1
+    ok = which < bins
+    sums = np.bincount(which[ok], weights=field.ravel()[ok], minlength=bins)
+    counts = np.bincount(which[ok], minlength=bins)
+    return edges[:-1], sums / np.maximum(counts, 1)
+
+#=====================================================
+# moshpit tracks from clusters.txt
+#=====================================================
+def readClusters(filename="clusters.txt"):
+    # columns: t id size cmx cmy L age
+    data = np.loadtxt(filename, ndmin=2)
+    tracks = {}
+    for cid in np.unique(data[:,1]).astype(int):
+        tracks[cid] = data[data[:,1] == cid]
+    return tracks
+
+def clusterLifetimes(tracks):
+    # tracks still alive at the end of the run are censored
+    tend = max(tr[-1,0] for tr in tracks.values())
+    life = np.array([tr[-1,6] for tr in tracks.values()])
+    alive = np.array([tr[-1,0] == tend for tr in tracks.values()])
+    return life, alive
+
+#=====================================================
+# trajectories recorded with ./entbody -r
+#=====================================================
+def readTrajectory(filename="trajectory.bin"):
+    # the frames stay on disk, only those indexed are read
+    head = np.memmap(filename, dtype=np.int64, mode="r", shape=(6,))
+    N, stride = int(head[1]), int(head[2])
+    L, dt = np.array(head[3:5]).view(np.float64)
+    types = np.memmap(filename, dtype=np.int32, mode="r", offset=48, shape=(N,))
+    rad = np.memmap(filename, dtype=np.float32, mode="r", offset=48+4*N, shape=(N,))
+    frame = np.dtype([("t", "<f8"), ("x", "<f4", (N,2)), ("v", "<f4", (N,2)), ("col", "<f4", N)])
+    nframes = (os.path.getsize(filename) - 48 - 8*N) // frame.itemsize
+    frames = np.memmap(filename, dtype=frame, mode="r", offset=48+8*N, shape=(nframes,))
+    return {"N": N, "L": L, "dt": dt, "stride": stride, "type": types, "rad": rad, "frames": frames}
+
 #=====================================================
 # helper functions that generate a MB fit
 #=====================================================
@@ -96,19 +360,23 @@ def showFitToMB(T, vreal, preal):
     pl.title("Velocity Distribution in Moshpit", fontsize=20)
     pl.savefig("velocitydist.png")
 
-def runVelocityFit():
-    setOptions(velocities=1)
-    runSingleMoshpit(0.2,0.6,1,0.3)
-    setOptions(velocities=1, opengl=1)
+def runVelocityFit(steps=10000):
+    buildLibrary()
+    sim = Entbody(0.2,0.6,1,0.3)
 
-    r = np.fromfile(open("velocities.txt", "rb"))
-    r = r[r<6]
-    
-    h = pl.hist(r, bins=80)
+    edges = np.linspace(0, 6, 81)
+    counts = np.zeros(len(edges)-1)
+    for i in range(steps):
+        sim.step(1)
+        r = np.sqrt((sim.v**2).sum(axis=1))
+        counts += np.histogram(r, bins=edges)[0]
+
+    vreal = edges[:-1]
+    pl.figure()
+    pl.bar(vreal, counts, width=vreal[1]-vreal[0])
     pl.show()
     
-    vreal = h[1][:-1]
-    preal = 1.*h[0] / h[0].sum() / (vreal[1] - vreal[0]) 
+    preal = 1.*counts / counts.sum() / (vreal[1] - vreal[0]) 
     
     f = opt.fmin(fitToMB, [6], args=(vreal,preal), xtol=1e-8, disp=0)
     showFitToMB(f, vreal, preal)
@@ -117,24 +385,30 @@ def runVelocityFit():
 #====================================================
 # functions that generate the temperature profile
 #====================================================
+def temperatureBins(damp, alpha=0.0, eta=0.0, seed=1, steps=10000):
+    sim = Entbody(alpha, eta, seed, damp)
+    bins = np.zeros((10, 50), dtype=np.intc)
+    for i in range(steps):
+        sim.step(1)
+        sim.temperature(bins)
+    return bins
+
+def fitTemperature(bins, rad):
+    p = bins[rad,:]
+    vreal = np.arange(0, 125, 125.0/50)
+    preal = 1.*p / p.sum() / (vreal[1] - vreal[0]) 
+    f = opt.fmin(fitToMB, [30], args=(vreal,preal), xtol=1e-8, disp=0)
+    return f[0], vreal, preal
+
 def runTemperatureFits():
-    def dofit(damp, rad):
-        r = np.loadtxt("temp_%0.2f" % damp + ".txt")
-        p = r[rad,:]
-        vreal = np.arange(0, 125, 125.0/50)
-        preal = 1.*p / p.sum() / (vreal[1] - vreal[0]) 
-        f = opt.fmin(fitToMB, [30], args=(vreal,preal), xtol=1e-8, disp=0)
-        return f[0]
-
-    setOptions(temperature=1)
+    buildLibrary()
     pl.figure()
     for i in np.arange(0.1, 0.5, 0.1):
-        runSingleMoshpit(0.0,0.0,1,i)
+        bins = temperatureBins(i)
         temps = []
         for j in range(6):
-            temps.append(dofit(i,j))
+            temps.append(fitTemperature(bins,j)[0])
         pl.plot(range(len(temps)), temps, 'o-', label=r"$\beta=%0.2f$" % i)
-    setOptions(opengl=1)
 
     pl.xlabel(r'$|r|$', fontsize=20)
     pl.ylabel(r'$T(r)$', fontsize=20)
@@ -142,25 +416,14 @@ def runTemperatureFits():
     pl.savefig("temperature.png")
 
 def runTemperatureSlice(beta=0.25):
-    def dofit(damp, rad):
-        r = np.loadtxt("temp_%0.2f" % damp + ".txt")
-        p = r[rad,:]
-        vreal = np.arange(0, 125, 125.0/50)
-        preal = 1.*p / p.sum() / (vreal[1] - vreal[0]) 
-        f = opt.fmin(fitToMB, [30], args=(vreal,preal), xtol=1e-8, disp=0)
-        pl.plot(preal, 'o', label=str(rad))
-        pl.plot(MB(vreal, f[0]), '-')
-        return f[0]
-
-    setOptions(temperature=1)
+    buildLibrary()
     pl.figure()
-    runSingleMoshpit(0.1,1.9,1,beta)
-    temps = []
+    bins = temperatureBins(beta, 0.1, 1.9)
     for j in range(10):
-        ttemp = dofit(beta,j)
-        #pl.plot(range(len(temps)), temps, 'o-', label=r"$\beta=%0.2f$" % i)
+        T, vreal, preal = fitTemperature(bins,j)
+        pl.plot(preal, 'o', label=str(j))
+        pl.plot(MB(vreal, T), '-')
     pl.legend()
-    setOptions(opengl=1)
 
     pl.xlabel(r'$|r|$', fontsize=20)
     pl.ylabel(r'$T(r)$', fontsize=20)
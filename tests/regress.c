@@ -0,0 +1,289 @@
+//===================================================
+// Project: Collective motion at heavy metal concerts
+//===================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include "entbody.h"
+
+//===================================================
+// golden trajectory regression suite (make test)
+//  - trajectories: fixed seeds and parameters are run
+//    for a few hundred steps with the two pass step, the
+//    fused step and the hashed grid, and the final
+//    positions and velocities are compared with the
+//    stored state, bitwise or within -t tol
+//  - ensemble: a set of seeds at one point gives the
+//    per seed time averages of the six moments behind
+//    the printed means (L, L^2, px, py, px^2, py^2) and
+//    the RED speed histogram; their means must lie
+//    within ENS_Z combined standard errors of the
+//    stored ones
+// -g writes new reference files instead of checking.
+// the reference states are always written with the two
+// pass step on the dense grid; the fused and hashed
+// modes are only checked against them.  a failure in
+// one of those modes alone is a bug in that mode, not a
+// reason to regenerate the references
+//===================================================
+#define ENS_SEEDS   16
+#define ENS_STEPS   1000
+#define ENS_SKIP    200
+#define ENS_BINS    10
+#define ENS_VMAX    2.0
+#define ENS_Z       4.0
+#define ENS_NSTATS  (6+ENS_BINS)
+
+typedef struct {
+    long   N;
+    double alpha, eta;
+    int    seed;
+    double damp;
+    long   steps;
+} case_t;
+
+static case_t traj_cases[] = {
+    { 500, 0.5, 0.3,  7, 0.5, 200},
+    { 500, 1.5, 1.0,  3, 1.0, 200},
+    {1000, 0.0, 0.0, 11, 1.0, 100},
+};
+#define NTRAJ ((int)(sizeof(traj_cases)/sizeof(case_t)))
+
+static case_t ens_case = {500, 0.2, 1.0, 0, 1.0, ENS_STEPS};
+
+static const char *ens_names[6] = {"L", "L2", "px", "py", "px2", "py2"};
+
+//===================================================
+// trajectories
+//===================================================
+static double max_diff(double *a, double *b, long n, double L){
+    double m = 0.0;
+    long i;
+    for (i=0; i<n; i++){
+        double d = fabs(a[i] - b[i]);
+        if (L > 0 && d > L/2) d = L - d;
+        if (d > m) m = d;
+    }
+    return m;
+}
+
+static const char *mode_names[3] = {"two pass", "fused", "hashed"};
+
+static int check_trajectory(case_t *c, int mode, const char *golden, double tol){
+    entbody_view_t run, ref;
+    long i;
+
+    entbody_t *s = entbody_create(c->N, c->alpha, c->eta, c->seed, c->damp);
+    entbody_set_fused(s, mode == 1);
+    entbody_set_grid(s, mode == 2);
+    entbody_step(s, c->steps);
+    entbody_view(s, &run);
+
+    entbody_t *g = entbody_create(c->N, c->alpha, c->eta, c->seed, c->damp);
+    if (!entbody_load(g, golden)){
+        printf("  missing or unreadable %s\n", golden);
+        entbody_destroy(s);
+        entbody_destroy(g);
+        return 0;
+    }
+    entbody_view(g, &ref);
+
+    for (i=0; i<c->N; i++)
+        if (run.type[i] != ref.type[i]) break;
+    int good = i == c->N;
+    double dx = max_diff(run.x, ref.x, 2*c->N, run.L);
+    double dv = max_diff(run.v, ref.v, 2*c->N, 0);
+
+    if (tol > 0)
+        good = good && dx <= tol && dv <= tol;
+    else
+        good = good && memcmp(run.x, ref.x, sizeof(double)*2*c->N) == 0
+                    && memcmp(run.v, ref.v, sizeof(double)*2*c->N) == 0;
+
+    printf("  %s N=%li alpha=%g eta=%g seed=%i damp=%g steps=%li %s: max|dx| = %g max|dv| = %g\n",
+            good ? "ok  " : "FAIL", c->N, c->alpha, c->eta, c->seed, c->damp, c->steps,
+            mode_names[mode], dx, dv);
+
+    entbody_destroy(s);
+    entbody_destroy(g);
+    return good;
+}
+
+static int write_trajectory(case_t *c, const char *golden){
+    entbody_t *s = entbody_create(c->N, c->alpha, c->eta, c->seed, c->damp);
+    entbody_step(s, c->steps);
+    int good = entbody_save(s, golden);
+    entbody_destroy(s);
+    printf("  wrote %s\n", golden);
+    return good;
+}
+
+//===================================================
+// ensemble statistics, one row of ENS_NSTATS per seed
+//===================================================
+static void ensemble_seed(case_t *c, int seed, double *stats){
+    entbody_view_t view;
+    entbody_obs_t obs;
+    long t, i;
+    int k;
+
+    for (k=0; k<ENS_NSTATS; k++)
+        stats[k] = 0.0;
+
+    entbody_t *s = entbody_create(c->N, c->alpha, c->eta, seed, c->damp);
+    entbody_step(s, ENS_SKIP);
+
+    long nred = 0;
+    for (t=0; t<c->steps; t++){
+        entbody_step(s, 1);
+        entbody_observe(s, &obs);
+        stats[0] += obs.angularmom;
+        stats[1] += obs.angularmom*obs.angularmom;
+        stats[2] += obs.momentumx;
+        stats[3] += obs.momentumy;
+        stats[4] += obs.momentumx*obs.momentumx;
+        stats[5] += obs.momentumy*obs.momentumy;
+
+        entbody_view(s, &view);
+        for (i=0; i<view.N; i++){
+            if (view.type[i] != RED) continue;
+            double speed = sqrt(view.v[2*i+0]*view.v[2*i+0] + view.v[2*i+1]*view.v[2*i+1]);
+            int b = (int)(speed / ENS_VMAX * ENS_BINS);
+            if (b >= ENS_BINS) b = ENS_BINS-1;
+            stats[6+b] += 1;
+            nred++;
+        }
+    }
+
+    for (k=0; k<6; k++)
+        stats[k] /= c->steps;
+    for (k=0; k<ENS_BINS; k++)
+        stats[6+k] /= nred;
+    entbody_destroy(s);
+}
+
+static void ensemble(case_t *c, double *mean, double *sem){
+    double stats[ENS_NSTATS], m2[ENS_NSTATS];
+    int seed, k;
+
+    for (k=0; k<ENS_NSTATS; k++)
+        mean[k] = m2[k] = 0.0;
+
+    for (seed=0; seed<ENS_SEEDS; seed++){
+        ensemble_seed(c, c->seed + seed, stats);
+        for (k=0; k<ENS_NSTATS; k++){
+            double delta = stats[k] - mean[k];
+            mean[k] += delta / (seed+1);
+            m2[k]   += delta * (stats[k] - mean[k]);
+        }
+    }
+    for (k=0; k<ENS_NSTATS; k++)
+        sem[k] = sqrt(m2[k] / (ENS_SEEDS-1) / ENS_SEEDS);
+}
+
+static void stat_name(int k, char *name){
+    if (k < 6)
+        strcpy(name, ens_names[k]);
+    else
+        sprintf(name, "speed%02i", k-6);
+}
+
+static int check_ensemble(case_t *c, const char *golden){
+    double mean[ENS_NSTATS], sem[ENS_NSTATS];
+    double rmean[ENS_NSTATS], rsem[ENS_NSTATS];
+    char name[80], rname[80];
+    int k, good = 1;
+
+    FILE *file = fopen(golden, "r");
+    if (!file){
+        printf("  missing %s\n", golden);
+        return 0;
+    }
+    for (k=0; k<ENS_NSTATS; k++){
+        if (fscanf(file, "%79s %lf %lf", rname, &rmean[k], &rsem[k]) != 3){
+            printf("  short reference file %s\n", golden);
+            fclose(file);
+            return 0;
+        }
+    }
+    fclose(file);
+
+    ensemble(c, mean, sem);
+    for (k=0; k<ENS_NSTATS; k++){
+        stat_name(k, name);
+        double bound = ENS_Z * sqrt(sem[k]*sem[k] + rsem[k]*rsem[k]) + 1e-12;
+        int ok = fabs(mean[k] - rmean[k]) <= bound;
+        printf("  %s %-8s %12.6f  ref %12.6f  |diff| %10.6f  bound %10.6f\n",
+                ok ? "ok  " : "FAIL", name, mean[k], rmean[k], fabs(mean[k] - rmean[k]), bound);
+        good = good && ok;
+    }
+    return good;
+}
+
+static int write_ensemble(case_t *c, const char *golden){
+    double mean[ENS_NSTATS], sem[ENS_NSTATS];
+    char name[80];
+    int k;
+
+    FILE *file = fopen(golden, "w");
+    if (!file) return 0;
+    ensemble(c, mean, sem);
+    for (k=0; k<ENS_NSTATS; k++){
+        stat_name(k, name);
+        fprintf(file, "%s %.17g %.17g\n", name, mean[k], sem[k]);
+    }
+    fclose(file);
+    printf("  wrote %s\n", golden);
+    return 1;
+}
+
+//===================================================
+// the main function
+//===================================================
+int main(int argc, char **argv){
+    const char *dir = "tests/golden";
+    double tol = 0.0;
+    int generate = 0;
+    int failed = 0;
+    char name[1024];
+    int i, opt;
+
+    while ((opt = getopt(argc, argv, "gt:")) != -1){
+        switch (opt){
+            case 'g': generate = 1; break;
+            case 't': tol = atof(optarg); break;
+            default:
+                printf("usage:\n\t./regress [-g] [-t tol] [golden directory]\n");
+                printf("\t  -g  write the reference files instead of checking\n");
+                printf("\t  -t  compare positions and velocities within tol (default bitwise)\n");
+                return 2;
+        }
+    }
+    if (argc - optind == 1)
+        dir = argv[optind];
+
+    printf("trajectories (%s)\n", generate ? "writing" : tol > 0 ? "tolerance" : "bitwise");
+    for (i=0; i<NTRAJ; i++){
+        sprintf(name, "%s/traj_%i.bin", dir, i);
+        if (generate)
+            failed += !write_trajectory(&traj_cases[i], name);
+        else {
+            int mode;
+            for (mode=0; mode<3; mode++)
+                failed += !check_trajectory(&traj_cases[i], mode, name, tol);
+        }
+    }
+
+    printf("ensemble: N=%li alpha=%g eta=%g damp=%g, %i seeds of %i steps\n",
+            ens_case.N, ens_case.alpha, ens_case.eta, ens_case.damp, ENS_SEEDS, ENS_STEPS);
+    sprintf(name, "%s/ensemble.txt", dir);
+    if (generate)
+        failed += !write_ensemble(&ens_case, name);
+    else
+        failed += !check_ensemble(&ens_case, name);
+
+    printf(failed ? "%i checks FAILED\n" : "all checks passed\n", failed);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,149 @@
+//===================================================
+// Project: Collective motion at heavy metal concerts
+//===================================================
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "traj.h"
+
+#define TRAJ_HEADER  (2*sizeof(int) + 2*sizeof(long) + 2*sizeof(double) + 2*sizeof(int))
+#define TRAJ_CHUNK   1024
+
+static size_t traj_framesize(long N){
+    return sizeof(double) + sizeof(float)*5*N;
+}
+
+// doubles go out as floats a chunk at a time
+static void write_floats(FILE *file, double *a, long n){
+    float buf[TRAJ_CHUNK];
+    long i, j;
+    for (i=0; i<n; i+=TRAJ_CHUNK){
+        long m = n-i < TRAJ_CHUNK ? n-i : TRAJ_CHUNK;
+        for (j=0; j<m; j++)
+            buf[j] = (float)a[i+j];
+        fwrite(buf, sizeof(float), m, file);
+    }
+}
+
+//===================================================
+// recording
+//===================================================
+FILE *traj_create(const char *name, entbody_view_t *view, long stride){
+    int magic = TRAJ_MAGIC, version = TRAJ_VERSION;
+
+    FILE *file = fopen(name, "wb");
+    if (!file) return NULL;
+
+    fwrite(&magic,      sizeof(int),    1, file);
+    fwrite(&version,    sizeof(int),    1, file);
+    fwrite(&view->N,    sizeof(long),   1, file);
+    fwrite(&stride,     sizeof(long),   1, file);
+    fwrite(&view->L,    sizeof(double), 1, file);
+    fwrite(&view->dt,   sizeof(double), 1, file);
+    fwrite(view->pbc,   sizeof(int),    2, file);
+    fwrite(view->type,  sizeof(int),    view->N, file);
+    write_floats(file, view->rad, view->N);
+    return file;
+}
+
+void traj_append(FILE *file, entbody_view_t *view){
+    fwrite(&view->t, sizeof(double), 1, file);
+    write_floats(file, view->x,   2*view->N);
+    write_floats(file, view->v,   2*view->N);
+    write_floats(file, view->col, view->N);
+}
+
+//===================================================
+// replay from a read only mapping.  the pages are
+// marked random so that skipping through a long run
+// does not read ahead the frames it jumps over, and
+// traj_prefetch asks for the next one explicitly
+//===================================================
+int traj_open(traj_t *tr, const char *name){
+    struct stat st;
+    int magic, version;
+
+    memset(tr, 0, sizeof(traj_t));
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) return 0;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < TRAJ_HEADER){
+        close(fd);
+        return 0;
+    }
+
+    tr->bytes = st.st_size;
+    tr->map = (char*)mmap(NULL, tr->bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (tr->map == MAP_FAILED){
+        tr->map = NULL;
+        return 0;
+    }
+
+    char *p = tr->map;
+    memcpy(&magic,     p, sizeof(int));    p += sizeof(int);
+    memcpy(&version,   p, sizeof(int));    p += sizeof(int);
+    memcpy(&tr->N,     p, sizeof(long));   p += sizeof(long);
+    memcpy(&tr->stride,p, sizeof(long));   p += sizeof(long);
+    memcpy(&tr->L,     p, sizeof(double)); p += sizeof(double);
+    memcpy(&tr->dt,    p, sizeof(double)); p += sizeof(double);
+    memcpy(tr->pbc,    p, 2*sizeof(int));  p += 2*sizeof(int);
+
+    // check N against the file before any size is computed
+    // from it, so a corrupt header cannot overflow them
+    long nmax = (tr->bytes - TRAJ_HEADER) / (sizeof(int) + sizeof(float));
+    if (magic != TRAJ_MAGIC || version != TRAJ_VERSION ||
+        tr->N <= 0 || tr->N > nmax || tr->stride <= 0 ||
+        !isfinite(tr->L) || tr->L <= 0){
+        traj_close(tr);
+        return 0;
+    }
+
+    tr->type = (int*)p;
+    tr->rad  = (float*)(p + sizeof(int)*tr->N);
+    tr->header    = TRAJ_HEADER + tr->N*(sizeof(int) + sizeof(float));
+    tr->framesize = traj_framesize(tr->N);
+    tr->nframes   = (tr->bytes - tr->header) / tr->framesize;
+
+    madvise(tr->map, tr->bytes, MADV_RANDOM);
+    return 1;
+}
+
+void traj_close(traj_t *tr){
+    if (tr->map)
+        munmap(tr->map, tr->bytes);
+    memset(tr, 0, sizeof(traj_t));
+}
+
+void traj_prefetch(traj_t *tr, long k){
+    if (k < 0 || k >= tr->nframes) return;
+    long page = sysconf(_SC_PAGESIZE);
+    size_t start = tr->header + k*tr->framesize;
+    size_t align = start - start % page;
+    madvise(tr->map + align, start - align + tr->framesize, MADV_WILLNEED);
+}
+
+// decode frame k (0 <= k < nframes) into the double arrays
+// that are not NULL, returning its time, or -1 out of range
+double traj_frame(traj_t *tr, long k, double *x, double *v, double *col){
+    long N = tr->N;
+    long i;
+    double t;
+
+    if (k < 0 || k >= tr->nframes)
+        return -1.0;
+
+    char *p = tr->map + tr->header + k*tr->framesize;
+    memcpy(&t, p, sizeof(double));
+    float *fx = (float*)(p + sizeof(double));
+    float *fv = fx + 2*N;
+    float *fc = fv + 2*N;
+
+    if (x)   for (i=0; i<2*N; i++) x[i]   = fx[i];
+    if (v)   for (i=0; i<2*N; i++) v[i]   = fv[i];
+    if (col) for (i=0; i<N; i++)   col[i] = fc[i];
+    return t;
+}
@@ -0,0 +1,47 @@
+#ifndef __TRAJ_H__
+#define __TRAJ_H__
+
+#include <stdio.h>
+#include <stddef.h>
+#include "entbody.h"
+
+//===================================================
+// recorded trajectories for replay.  a header and the
+// per particle constants are followed by frames of one
+// fixed size, so frame k sits at a known offset and a
+// seek costs nothing:
+//   int magic, version; long N, stride; double L, dt;
+//   int pbc[2]; int type[N]; float rad[N];
+//   frames of { double t; float x[N][2], v[N][2], col[N]; }
+// the reader maps the file and decodes only the frames
+// it is asked for; a partly written last frame (a run
+// that was killed) is ignored
+//===================================================
+#define TRAJ_MAGIC   0x4a415254
+#define TRAJ_VERSION 1
+
+typedef struct {
+    long   N;
+    long   stride;      // simulation steps between frames
+    double L, dt;
+    int    pbc[2];
+    long   nframes;
+
+    int    *type;       // [N] pointers into the mapping
+    float  *rad;        // [N]
+
+    char   *map;
+    size_t bytes;
+    size_t header;      // offset of frame 0
+    size_t framesize;
+} traj_t;
+
+FILE *traj_create(const char *name, entbody_view_t *view, long stride);
+void  traj_append(FILE *file, entbody_view_t *view);
+
+int    traj_open(traj_t *tr, const char *name);
+void   traj_close(traj_t *tr);
+double traj_frame(traj_t *tr, long k, double *x, double *v, double *col);
+void   traj_prefetch(traj_t *tr, long k);
+
+#endif
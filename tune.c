@@ -0,0 +1,184 @@
+//===================================================
+// Project: Collective motion at heavy metal concerts
+//===================================================
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "entbody_internal.h"
+
+#ifdef OPENMP
+#include <omp.h>
+#endif
+
+//===================================================
+// startup autotuning of the layout: a few timed trial
+// steps for each candidate box size and thread count.
+// the state is restored after every trial, so tuning
+// does not change the run.  the winner is cached by
+// the problem signature (N, packing fraction, RED
+// fraction and available threads)
+//===================================================
+#define TUNE_WARMUP 2
+#define TUNE_STEPS  10
+#define TUNE_TIME   0.05    // seconds per trial, at least
+
+static const double tune_edges[] = {1.0, 1.15, 1.3, 1.5, 1.75, 2.0};
+
+typedef struct {
+    long   N;
+    double phi;
+    double fred;
+    int    maxthreads;
+} signature_t;
+
+static double now(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static int max_threads(){
+    #ifdef OPENMP
+    return omp_get_max_threads();
+    #else
+    return 1;
+    #endif
+}
+
+static void set_threads(int n){
+    #ifdef OPENMP
+    omp_set_num_threads(n);
+    #endif
+}
+
+static void tune_signature(entbody_t *s, signature_t *sig){
+    long i, nred = 0;
+    double area = 0.0;
+    for (i=0; i<s->N; i++){
+        area += pi*s->rad[i]*s->rad[i];
+        if (s->type[i] == RED) nred++;
+    }
+    sig->N = s->N;
+    sig->phi = area / (s->L*s->L);
+    sig->fred = (double)nred / s->N;
+    sig->maxthreads = max_threads();
+}
+
+static int tune_lookup(const char *cache, signature_t *sig, int *ncell, int *nthreads){
+    FILE *file = fopen(cache, "r");
+    if (!file) return 0;
+
+    signature_t c;
+    int tc, tt, found = 0;
+    double rate;
+    while (fscanf(file, "%li %lf %lf %i %i %i %lf", &c.N, &c.phi, &c.fred,
+                &c.maxthreads, &tc, &tt, &rate) == 7){
+        if (c.N == sig->N && c.maxthreads == sig->maxthreads &&
+            fabs(c.phi - sig->phi) < 1e-3 && fabs(c.fred - sig->fred) < 1e-2){
+            *ncell = tc;
+            *nthreads = tt;
+            found = 1;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+// steps per second over a few steps, restoring the state afterwards
+static double tune_trial(entbody_t *s, double *x0, double *v0, double *o0, double *col0){
+    unsigned long long vran = s->vran;
+    double t = s->t;
+    long step = s->step;
+    long N = s->N;
+
+    entbody_step(s, TUNE_WARMUP);
+    double start = now();
+    double elapsed;
+    long nsteps = 0;
+    do {
+        entbody_step(s, TUNE_STEPS);
+        nsteps += TUNE_STEPS;
+        elapsed = now() - start;
+    } while (elapsed < TUNE_TIME);
+    double rate = nsteps / elapsed;
+
+    memcpy(s->x, x0, sizeof(double)*2*N);
+    memcpy(s->v, v0, sizeof(double)*2*N);
+    memcpy(s->o, o0, sizeof(double)*2*N);
+    memcpy(s->col, col0, sizeof(double)*N);
+    s->vran = vran;
+    s->t = t;
+    s->step = step;
+    return rate;
+}
+
+void entbody_autotune(entbody_t *s, const char *cache){
+    signature_t sig;
+    int i, ncell, nthreads;
+    int nmax = (int)(s->L / s->FR);
+    double best = 0.0;
+
+    tune_signature(s, &sig);
+    if (cache && tune_lookup(cache, &sig, &ncell, &nthreads)){
+        entbody_set_cells(s, ncell);
+        set_threads(nthreads);
+        fprintf(stderr, "autotune: N=%li phi=%0.3f fred=%0.3f -> %ix%i boxes, %i threads (cached)\n",
+                sig.N, sig.phi, sig.fred, s->size[0], s->size[1], nthreads);
+        return;
+    }
+
+    long N = s->N;
+    double *x0   = (double*)malloc(sizeof(double)*2*N);
+    double *v0   = (double*)malloc(sizeof(double)*2*N);
+    double *o0   = (double*)malloc(sizeof(double)*2*N);
+    double *col0 = (double*)malloc(sizeof(double)*N);
+    memcpy(x0, s->x, sizeof(double)*2*N);
+    memcpy(v0, s->v, sizeof(double)*2*N);
+    memcpy(o0, s->o, sizeof(double)*2*N);
+    memcpy(col0, s->col, sizeof(double)*N);
+
+    ncell = nmax;
+    nthreads = sig.maxthreads;
+    int lastcell = 0;
+    for (i=0; i<(int)(sizeof(tune_edges)/sizeof(double)); i++){
+        int tc = (int)(nmax / tune_edges[i]);
+        if (tc == lastcell || !entbody_set_cells(s, tc))
+            continue;
+        lastcell = tc;
+
+        int tt = 1;
+        while (1){
+            set_threads(tt);
+            double rate = tune_trial(s, x0, v0, o0, col0);
+            fprintf(stderr, "autotune:   %ix%i boxes, %i threads: %f steps/s\n", tc, tc, tt, rate);
+            if (rate > best){
+                best = rate;
+                ncell = tc;
+                nthreads = tt;
+            }
+            if (tt == sig.maxthreads) break;
+            tt = 2*tt < sig.maxthreads ? 2*tt : sig.maxthreads;
+        }
+    }
+
+    entbody_set_cells(s, ncell);
+    set_threads(nthreads);
+    fprintf(stderr, "autotune: N=%li phi=%0.3f fred=%0.3f -> %ix%i boxes, %i threads (%f steps/s)\n",
+            sig.N, sig.phi, sig.fred, ncell, ncell, nthreads, best);
+
+    if (cache){
+        FILE *file = fopen(cache, "a");
+        if (file){
+            fprintf(file, "%li %f %f %i %i %i %f\n", sig.N, sig.phi, sig.fred,
+                    sig.maxthreads, ncell, nthreads, best);
+            fclose(file);
+        }
+    }
+
+    free(x0);
+    free(v0);
+    free(o0);
+    free(col0);
+}